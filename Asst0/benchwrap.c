@@ -0,0 +1,49 @@
+/*
+ * Allocation counting for the benchmark build of the tokenizer.
+ * The benchmark build is linked with --wrap=malloc,--wrap=calloc and
+ * --wrap=realloc, so every allocation the tokenizer and the lexer make
+ * goes through here first. The total is printed to stderr on exit for
+ * tokbench to pick up.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+void *__real_malloc(size_t);
+void *__real_calloc(size_t, size_t);
+void *__real_realloc(void *, size_t);
+void *__wrap_malloc(size_t);
+void *__wrap_calloc(size_t, size_t);
+void *__wrap_realloc(void *, size_t);
+
+/* Bumped from every thread, so it is only ever added to atomically */
+static unsigned long allocations;
+
+void *__wrap_malloc(size_t size)
+{
+	__sync_fetch_and_add(&allocations, 1);
+	return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size)
+{
+	__sync_fetch_and_add(&allocations, 1);
+	return __real_calloc(nmemb, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+	__sync_fetch_and_add(&allocations, 1);
+	return __real_realloc(ptr, size);
+}
+
+static void print_allocations(void)
+{
+	fprintf(stderr, "allocations: %lu\n", allocations);
+}
+
+__attribute__((constructor))
+static void start_counting(void)
+{
+	atexit(print_allocations);
+}
@@ -0,0 +1,888 @@
+/*
+ * C Lexer.
+ * Authors: Christopher Naporlee && Michael Nelli
+ * CS214 Systems Programming | Section 5
+ * Description:
+ * 	The lexer behind the tokenizer, built as a library so it can be
+ * 	used without the tokenizer's printing. The tables it runs off of are
+ * 	generated the first time a lexer is set up, after that every lexer
+ * 	only touches its own struct so separate threads can each use one.
+ * 	See lexer.h for how to use it.
+ */
+
+#include <ctype.h>
+#include <err.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lexer.h"
+#include "number.h"
+#include "scan.h"
+
+#define ARRAY_SIZE(arr) ((int) (sizeof(arr)/sizeof(*(arr))))
+
+/* Size of the buffer used to stream input from files */
+#ifndef READ_BUFFER_SIZE
+#define READ_BUFFER_SIZE 65536
+#endif
+
+/*
+ * Lexer table entries. The low byte is the state to move to, the rest are
+ * flags saying what to do with the token being built when moving there.
+ */
+#define LEX_STATE	0x0ff
+#define LEX_EMIT	0x100 /* Token ends right before this character */
+#define LEX_EMIT_BACK	0x200 /* Token ends one character before that */
+#define LEX_START	0x400 /* A new token starts on this character */
+
+/* Number of slots in the keyword hash table, has to be a power of 2 */
+#define KEYWORD_HASH_SIZE 64
+
+/* Marks lexer states that are not in the middle of a token */
+#define NOT_A_TOKEN	-1
+
+/* Marks word states in the middle of a UTF-8 character */
+#define PARTIAL_WORD	-2
+
+/*
+ * Symbols that can ONLY be themselves. Even though "!=" and "^=" are in the
+ * C_tokens table, '!' and '^' are never joined with what follows them.
+ */
+#define SINGLE_SYMBOLS "()[].,!~^?:"
+
+/* C Token struct to be used to make arrays of C keywords and symbols */
+struct C_token {
+	const char *name;
+	const char *operator;
+};
+
+/* Keyword hash table slot. Index is 1 + the keyword's C_keywords index */
+struct keyword_slot {
+	unsigned char length;
+	unsigned char index;
+};
+
+/*
+ * Character classes the lexer sorts every input byte into. Each character
+ * used in a C_tokens operator gets a class of its own after CC_SYMBOL.
+ * Bytes of UTF-8 characters are split up finely enough to tell a valid
+ * character from a bad one, bytes that are never valid UTF-8 are CC_OTHER.
+ */
+enum char_class {
+	CC_OTHER,
+	CC_SPACE,
+	CC_NEWLINE,
+	CC_LETTER,
+	CC_HEX_LETTER,
+	CC_E,
+	CC_X,
+	CC_ZERO,
+	CC_OCTAL,
+	CC_DIGIT,
+	CC_PUNCT,
+	CC_QUOTE,
+	CC_APOSTROPHE,
+	CC_BACKSLASH,
+	CC_UTF8_CONT_LOW,	/* 0x80-0x8f */
+	CC_UTF8_CONT_MID,	/* 0x90-0x9f */
+	CC_UTF8_CONT_HIGH,	/* 0xa0-0xbf */
+	CC_UTF8_LEAD2,		/* 0xc2-0xdf, first of 2 bytes */
+	CC_UTF8_E0,
+	CC_UTF8_LEAD3,		/* 0xe1-0xef other than 0xed, first of 3 bytes */
+	CC_UTF8_ED,
+	CC_UTF8_F0,
+	CC_UTF8_LEAD4,		/* 0xf1-0xf3, first of 4 bytes */
+	CC_UTF8_F4,
+	CC_SYMBOL
+};
+
+/*
+ * Lexer states. The state for symbol i of C_tokens is SYMBOL_STATE + i,
+ * which is how a finished symbol token knows its type.
+ */
+enum lex_state {
+	START,
+	LINE_COMMENT,
+	BLOCK_COMMENT,
+	BLOCK_COMMENT_STAR,	/* Block comment that might be closing */
+	WORD,
+	WORD_UTF8_1,		/* Word needing 1 more byte of a UTF-8 character */
+	WORD_UTF8_2,
+	WORD_UTF8_3,
+	WORD_UTF8_E0,		/* Word that just read a 0xe0, 0xed, 0xf0 or 0xf4, */
+	WORD_UTF8_ED,		/* which limit the byte after them */
+	WORD_UTF8_F0,
+	WORD_UTF8_F4,
+	NUM_ZERO,		/* "0" */
+	NUM_OCTAL,		/* "0" followed by only 0-7 */
+	NUM_DECIMAL,
+	NUM_DOT,		/* Number ending in its first '.' */
+	NUM_FLOAT,
+	NUM_EXPONENT,		/* Float that just read an 'e' */
+	NUM_EXPONENT_SLASH,	/* Exponent followed by a '/', maybe a comment */
+	NUM_HEX,
+	NUM_HEX_BAD,		/* "0x" followed by something not hex */
+	STRING,
+	STRING_ESCAPE,		/* String that just read a backslash */
+	STRING_END,		/* String that just read its closing '"' */
+	CHAR,
+	CHAR_ESCAPE,
+	CHAR_END,
+	UNKNOWN_SYMBOL,
+	SYMBOL_STATE
+};
+
+static int fill_buffer(struct lexer *);
+static int find_symbol(const char *op, int len);
+static int next_token(struct lexer *, struct token *);
+static int token_equals(const char *tok, int len, const char *str);
+static int word_type(const char *word, int len);
+static unsigned int hash_word(const char *word, int len);
+static void count_lines(struct lexer *, size_t upto);
+static void init_keywords(void);
+static void init_lexer(void);
+static int utf8_class(int c);
+
+/*
+ * Array to keep track of all operators used in the C language.
+ * Used mainly to parse symbols given by user input.
+ */
+static const struct C_token C_tokens[NUM_C_SYMBOLS] = {
+	{"left parenthesis", "("},
+	{"right parenthesis", ")"},
+	{"left brace", "["},
+	{"right brace", "]"},
+	{"structure member", "."},
+	{"structure pointer", "->"},
+	{"comma", ","},
+	{"negate", "!"},
+	{"1s complement", "~"},
+	{"shift right", ">>"},
+	{"shift left", "<<"},
+	{"bitwise XOR", "^"},
+	{"bitwise OR", "|"},
+	{"increment", "++"},
+	{"decrement", "--"},
+	{"addition", "+"},
+	{"division", "/"},
+	{"modulo", "%"},
+	{"logical OR", "||"},
+	{"logical AND", "&&"},
+	{"conditional true", "?"},
+	{"conditional false", ":"},
+	{"equality test", "=="},
+	{"inequality test", "!="},
+	{"less than test", "<"},
+	{"greater than test", ">"},
+	{"less than or equal test", "<="},
+	{"greater than or equal test", ">="},
+	{"assignment", "="},
+	{"plus equals", "+="},
+	{"minus equals", "-="},
+	{"times equals", "*="},
+	{"divide equals", "/="},
+	{"mod equals", "%="},
+	{"shift right equals", ">>="},
+	{"shift left equals", "<<="},
+	{"bitwise AND equals", "&="},
+	{"bitwise XOR equals", "^="},
+	{"bitwise OR equals", "|="},
+	{"AND/address operator", "&"},
+	{"minus/subtract operator", "-"},
+	{"multiply/dereference operator", "*"},
+};
+
+/*
+ * Array to keep track of all keywords used in the C language.
+ * Used mainly to parse words given by user input to determine
+ * if they are a keyword or not.
+ */
+static const struct C_token C_keywords[NUM_C_KEYWORDS] = {
+	{"if keyword", "if"},
+	{"else keyword", "else"},
+	{"do keyword", "do"},
+	{"while keyword", "while"},
+	{"for keyword", "for"},
+	{"char keyword", "char"},
+	{"int keyword", "int"},
+	{"double keyword", "double"},
+	{"float keyword", "float"},
+	{"long keyword", "long"},
+	{"short keyword", "short"},
+	{"return keyword", "return"},
+	{"break keyword", "break"},
+	{"continue keyword", "continue"},
+	{"const keyword", "const"},
+	{"struct keyword", "struct"},
+	{"unsigned keyword", "unsigned"},
+	{"signed keyword", "signed"},
+	{"switch keyword", "switch"},
+	{"void keyword", "void"},
+	{"case keyword", "case"},
+	{"default keyword", "default"},
+	{"register keyword", "register"},
+	{"typedef keyword", "typedef"},
+	{"enum keyword", "enum"},
+	{"goto keyword", "goto"},
+	{"static keyword", "static"},
+	{"union keyword", "union"},
+	{"volatile keyword", "volatile"},
+	{"extern keyword", "extern"},
+	{"sizeof keyword", "sizeof"},
+};
+
+
+/* Fails to compile if a table above does not have exactly as many entries as lexer.h says */
+typedef char check_symbols[ARRAY_SIZE(C_tokens) == NUM_C_SYMBOLS ? 1 : -1];
+typedef char check_keywords[ARRAY_SIZE(C_keywords) == NUM_C_KEYWORDS ? 1 : -1];
+
+#define NUM_STATES	(SYMBOL_STATE + ARRAY_SIZE(C_tokens))
+#define NUM_CLASSES	(CC_SYMBOL + 32)
+
+/*
+ * The lexer's tables. These get generated by init_lexer() from the rules
+ * for each kind of token and from the C_tokens table, then the whole input
+ * is lexed in one pass by looking up one table entry per byte.
+ */
+static unsigned char char_class[256];
+static unsigned short lex_table[NUM_STATES][NUM_CLASSES];
+static int state_type[NUM_STATES];
+
+/*
+ * Perfect hash table of the C_keywords, also generated at startup. Every
+ * keyword gets a slot of its own so a word is a keyword only if it matches
+ * the one keyword sitting in its slot.
+ */
+static struct keyword_slot keyword_hash[KEYWORD_HASH_SIZE];
+static unsigned int keyword_seed;
+
+/* Makes sure the tables above only get generated once */
+static pthread_once_t tables_once = PTHREAD_ONCE_INIT;
+
+/*
+ * Takes in a token of length len and checks if it is the same as str.
+ * Returns 1 if they match, 0 if not.
+ */
+static int token_equals(const char *tok, int len, const char *str)
+{
+	return !strncmp(tok, str, len) && str[len] == '\0';
+}
+
+/*
+ * Finds the symbol in C_tokens made up of the first len characters of op.
+ * Returns its index, or -1 if there is no such symbol.
+ */
+static int find_symbol(const char *op, int len)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(C_tokens); i++) {
+		if (token_equals(op, len, C_tokens[i].operator))
+			return i;
+	}
+	return -1;
+}
+
+/* Hashes a word by its length and its first and last characters */
+static unsigned int hash_word(const char *word, int len)
+{
+	return (len + (unsigned char) word[0] * keyword_seed +
+		(unsigned char) word[len - 1]) & (KEYWORD_HASH_SIZE - 1);
+}
+
+/*
+ * Takes in a word and checks to see if it is a special C keyword, which
+ * only takes looking at the one slot the word hashes to.
+ * Returns the keyword's type if it is, TOK_WORD otherwise.
+ */
+static int word_type(const char *word, int len)
+{
+	const struct keyword_slot *slot = &keyword_hash[hash_word(word, len)];
+
+	if (slot->length == len &&
+	    !memcmp(word, C_keywords[slot->index - 1].operator, len))
+		return TOK_KEYWORD + slot->index - 1;
+	return TOK_WORD;
+}
+
+/*
+ * Generates the keyword hash table by trying seeds until one is found
+ * that gives every keyword in C_keywords its own slot.
+ */
+static void init_keywords(void)
+{
+	struct keyword_slot *slot;
+	const char *kw;
+	int i, len;
+
+	for (keyword_seed = 1; keyword_seed < 256; keyword_seed++) {
+		memset(keyword_hash, 0, sizeof(keyword_hash));
+		for (i = 0; i < ARRAY_SIZE(C_keywords); i++) {
+			kw = C_keywords[i].operator;
+			len = strlen(kw);
+			slot = &keyword_hash[hash_word(kw, len)];
+			if (slot->length)
+				break;
+			slot->length = len;
+			slot->index = i + 1;
+		}
+		if (i == ARRAY_SIZE(C_keywords))
+			return;
+	}
+	errx(1, "Could not find a perfect hash for the C keywords.");
+}
+
+/*
+ * Sorts a byte that is not ASCII into the UTF-8 class it belongs to.
+ * Returns CC_OTHER for bytes that can never be part of valid UTF-8.
+ */
+static int utf8_class(int c)
+{
+	if (c <= 0x8f)
+		return CC_UTF8_CONT_LOW;
+	if (c <= 0x9f)
+		return CC_UTF8_CONT_MID;
+	if (c <= 0xbf)
+		return CC_UTF8_CONT_HIGH;
+	if (c == 0xc0 || c == 0xc1)
+		return CC_OTHER;
+	if (c <= 0xdf)
+		return CC_UTF8_LEAD2;
+	if (c == 0xe0)
+		return CC_UTF8_E0;
+	if (c == 0xed)
+		return CC_UTF8_ED;
+	if (c <= 0xef)
+		return CC_UTF8_LEAD3;
+	if (c == 0xf0)
+		return CC_UTF8_F0;
+	if (c <= 0xf3)
+		return CC_UTF8_LEAD4;
+	if (c == 0xf4)
+		return CC_UTF8_F4;
+	return CC_OTHER;
+}
+
+/*
+ * Builds the character class and state transition tables the lexer runs
+ * off of. Every state starts out ending its token on any character and
+ * handling that character like START would, then each kind of token fills
+ * in the characters that keep it going.
+ */
+static void init_lexer(void)
+{
+	unsigned short route[NUM_CLASSES];
+	int c, i, j, len, state, num_classes = CC_SYMBOL;
+	const char *op;
+
+	/* Sort every byte into a character class */
+	for (c = 0; c < 256; c++) {
+		if (c >= 0x80)
+			char_class[c] = utf8_class(c);
+		else if (c == '\n')
+			char_class[c] = CC_NEWLINE;
+		else if (isspace(c))
+			char_class[c] = CC_SPACE;
+		else if (c == 'e')
+			char_class[c] = CC_E;
+		else if (c == 'x' || c == 'X')
+			char_class[c] = CC_X;
+		else if (isalpha(c))
+			char_class[c] = isxdigit(c) ? CC_HEX_LETTER : CC_LETTER;
+		else if (c == '0')
+			char_class[c] = CC_ZERO;
+		else if (c >= '1' && c <= '7')
+			char_class[c] = CC_OCTAL;
+		else if (isdigit(c))
+			char_class[c] = CC_DIGIT;
+		else if (c == '"')
+			char_class[c] = CC_QUOTE;
+		else if (c == '\'')
+			char_class[c] = CC_APOSTROPHE;
+		else if (c == '\\')
+			char_class[c] = CC_BACKSLASH;
+		else if (ispunct(c))
+			char_class[c] = CC_PUNCT;
+		else
+			char_class[c] = CC_OTHER;
+	}
+	for (i = 0; i < ARRAY_SIZE(C_tokens); i++) {
+		for (op = C_tokens[i].operator; *op; op++) {
+			if (char_class[(unsigned char) *op] == CC_PUNCT)
+				char_class[(unsigned char) *op] = num_classes++;
+		}
+	}
+
+	/* Where START goes on each class of character */
+	for (c = 0; c < NUM_CLASSES; c++) {
+		switch (c) {
+		case CC_SPACE: /* FALLTHROUGH */
+		case CC_NEWLINE:
+			route[c] = START;
+			break;
+		case CC_LETTER: /* FALLTHROUGH */
+		case CC_HEX_LETTER:
+		case CC_E:
+		case CC_X:
+			route[c] = WORD | LEX_START;
+			break;
+		case CC_ZERO:
+			route[c] = NUM_ZERO | LEX_START;
+			break;
+		case CC_OCTAL: /* FALLTHROUGH */
+		case CC_DIGIT:
+			route[c] = NUM_DECIMAL | LEX_START;
+			break;
+		case CC_QUOTE:
+			route[c] = STRING | LEX_START;
+			break;
+		case CC_APOSTROPHE:
+			route[c] = CHAR | LEX_START;
+			break;
+		case CC_UTF8_LEAD2:
+			route[c] = WORD_UTF8_1 | LEX_START;
+			break;
+		case CC_UTF8_E0:
+			route[c] = WORD_UTF8_E0 | LEX_START;
+			break;
+		case CC_UTF8_LEAD3:
+			route[c] = WORD_UTF8_2 | LEX_START;
+			break;
+		case CC_UTF8_ED:
+			route[c] = WORD_UTF8_ED | LEX_START;
+			break;
+		case CC_UTF8_F0:
+			route[c] = WORD_UTF8_F0 | LEX_START;
+			break;
+		case CC_UTF8_LEAD4:
+			route[c] = WORD_UTF8_3 | LEX_START;
+			break;
+		case CC_UTF8_F4:
+			route[c] = WORD_UTF8_F4 | LEX_START;
+			break;
+		default:
+			route[c] = UNKNOWN_SYMBOL | LEX_START;
+			break;
+		}
+	}
+	for (i = 0; i < ARRAY_SIZE(C_tokens); i++) {
+		op = C_tokens[i].operator;
+		if (op[1] == '\0')
+			route[char_class[(unsigned char) *op]] = (SYMBOL_STATE + i) | LEX_START;
+	}
+
+	/* Every token ends on any character unless told otherwise below */
+	for (state = 0; state < NUM_STATES; state++) {
+		state_type[state] = NOT_A_TOKEN;
+		for (c = 0; c < NUM_CLASSES; c++)
+			lex_table[state][c] = route[c] | LEX_EMIT;
+	}
+	for (c = 0; c < NUM_CLASSES; c++) {
+		lex_table[START][c] = route[c];
+		lex_table[LINE_COMMENT][c] = LINE_COMMENT;
+		lex_table[BLOCK_COMMENT][c] = BLOCK_COMMENT;
+		lex_table[BLOCK_COMMENT_STAR][c] = BLOCK_COMMENT;
+	}
+	lex_table[LINE_COMMENT][CC_NEWLINE] = START;
+	lex_table[BLOCK_COMMENT][char_class['*']] = BLOCK_COMMENT_STAR;
+	lex_table[BLOCK_COMMENT_STAR][char_class['*']] = BLOCK_COMMENT_STAR;
+	lex_table[BLOCK_COMMENT_STAR][char_class['/']] = START;
+
+	/* Words keep going as long as they are alphanumeric */
+	state_type[WORD] = TOK_WORD;
+	for (c = CC_LETTER; c <= CC_DIGIT; c++)
+		lex_table[WORD][c] = WORD;
+
+	/*
+	 * Every character that is not ASCII counts as a letter, as long as it
+	 * is valid UTF-8: the right number of continuation bytes, with the
+	 * second byte after 0xe0, 0xed, 0xf0 and 0xf4 limited so there are no
+	 * overlong forms, surrogates or code points past 0x10ffff. A word cut
+	 * off by a bad character is split up by next_token().
+	 */
+	for (c = CC_UTF8_LEAD2; c <= CC_UTF8_F4; c++)
+		lex_table[WORD][c] = route[c] & LEX_STATE;
+	for (c = CC_UTF8_CONT_LOW; c <= CC_UTF8_CONT_HIGH; c++) {
+		lex_table[WORD_UTF8_1][c] = WORD;
+		lex_table[WORD_UTF8_2][c] = WORD_UTF8_1;
+		lex_table[WORD_UTF8_3][c] = WORD_UTF8_2;
+	}
+	lex_table[WORD_UTF8_E0][CC_UTF8_CONT_HIGH] = WORD_UTF8_1;
+	lex_table[WORD_UTF8_ED][CC_UTF8_CONT_LOW] = WORD_UTF8_1;
+	lex_table[WORD_UTF8_ED][CC_UTF8_CONT_MID] = WORD_UTF8_1;
+	lex_table[WORD_UTF8_F0][CC_UTF8_CONT_MID] = WORD_UTF8_2;
+	lex_table[WORD_UTF8_F0][CC_UTF8_CONT_HIGH] = WORD_UTF8_2;
+	lex_table[WORD_UTF8_F4][CC_UTF8_CONT_LOW] = WORD_UTF8_2;
+	for (state = WORD_UTF8_1; state <= WORD_UTF8_F4; state++)
+		state_type[state] = PARTIAL_WORD;
+
+	/*
+	 * Numbers. Anything that is not a letter, a symbol or white space
+	 * stays part of the number but keeps it from being octal or hex.
+	 */
+	state_type[NUM_ZERO] = TOK_DECIMAL;
+	state_type[NUM_OCTAL] = TOK_OCTAL;
+	state_type[NUM_DECIMAL] = TOK_DECIMAL;
+	state_type[NUM_DOT] = TOK_DECIMAL;
+	lex_table[NUM_ZERO][CC_X] = NUM_HEX;
+	for (state = NUM_ZERO; state <= NUM_DECIMAL; state++) {
+		lex_table[state][CC_ZERO] = (state == NUM_DECIMAL) ? NUM_DECIMAL : NUM_OCTAL;
+		lex_table[state][CC_OCTAL] = (state == NUM_DECIMAL) ? NUM_DECIMAL : NUM_OCTAL;
+		lex_table[state][CC_DIGIT] = NUM_DECIMAL;
+		lex_table[state][CC_OTHER] = NUM_DECIMAL;
+		lex_table[state][char_class['.']] = NUM_DOT;
+	}
+
+	/* Once a '.' is followed by anything the number is a float */
+	state_type[NUM_FLOAT] = TOK_FLOAT;
+	state_type[NUM_EXPONENT] = TOK_FLOAT;
+	state_type[NUM_EXPONENT_SLASH] = TOK_FLOAT;
+	for (state = NUM_DOT; state <= NUM_FLOAT; state++) {
+		lex_table[state][CC_ZERO] = NUM_FLOAT;
+		lex_table[state][CC_OCTAL] = NUM_FLOAT;
+		lex_table[state][CC_DIGIT] = NUM_FLOAT;
+		lex_table[state][CC_OTHER] = NUM_FLOAT;
+		lex_table[state][char_class['.']] = NUM_FLOAT;
+		lex_table[state][CC_E] = NUM_EXPONENT;
+	}
+
+	/*
+	 * The 'e' of a float takes whatever character follows it along, other
+	 * than a quote, which always starts a string or character literal, or
+	 * a byte of a UTF-8 character, which can not be split up.
+	 */
+	for (c = 0; c < NUM_CLASSES; c++) {
+		if (c != CC_SPACE && c != CC_NEWLINE && c != CC_QUOTE && c != CC_APOSTROPHE &&
+		    (c < CC_UTF8_CONT_LOW || c > CC_UTF8_F4))
+			lex_table[NUM_EXPONENT][c] = NUM_FLOAT;
+		lex_table[NUM_EXPONENT_SLASH][c] = lex_table[NUM_FLOAT][c];
+	}
+	/* Or the start of a comment */
+	lex_table[NUM_EXPONENT][char_class['/']] = NUM_EXPONENT_SLASH;
+	lex_table[NUM_EXPONENT_SLASH][char_class['/']] = LINE_COMMENT | LEX_EMIT_BACK;
+	lex_table[NUM_EXPONENT_SLASH][char_class['*']] = BLOCK_COMMENT | LEX_EMIT_BACK;
+
+	/* Hex numbers keep going on hex digits */
+	state_type[NUM_HEX] = TOK_HEX;
+	state_type[NUM_HEX_BAD] = TOK_DECIMAL;
+	for (state = NUM_HEX; state <= NUM_HEX_BAD; state++) {
+		for (c = CC_HEX_LETTER; c <= CC_DIGIT; c++) {
+			if (c != CC_X)
+				lex_table[state][c] = state;
+		}
+		lex_table[state][CC_OTHER] = NUM_HEX_BAD;
+	}
+
+	/*
+	 * String and character literals keep going up to their closing quote,
+	 * with a '\\' taking the character after it along. Neither one can
+	 * hold a newline, so one still open at the end of a line is unknown.
+	 */
+	state_type[STRING] = TOK_UNKNOWN;
+	state_type[STRING_ESCAPE] = TOK_UNKNOWN;
+	state_type[STRING_END] = TOK_STRING;
+	state_type[CHAR] = TOK_UNKNOWN;
+	state_type[CHAR_ESCAPE] = TOK_UNKNOWN;
+	state_type[CHAR_END] = TOK_CHAR;
+	for (c = 0; c < NUM_CLASSES; c++) {
+		if (c == CC_NEWLINE)
+			continue;
+		lex_table[STRING][c] = STRING;
+		lex_table[STRING_ESCAPE][c] = STRING;
+		lex_table[CHAR][c] = CHAR;
+		lex_table[CHAR_ESCAPE][c] = CHAR;
+	}
+	lex_table[STRING][CC_QUOTE] = STRING_END;
+	lex_table[STRING][CC_BACKSLASH] = STRING_ESCAPE;
+	lex_table[CHAR][CC_APOSTROPHE] = CHAR_END;
+	lex_table[CHAR][CC_BACKSLASH] = CHAR_ESCAPE;
+
+	/* Symbols grow into the longest symbol in C_tokens they can make */
+	state_type[UNKNOWN_SYMBOL] = TOK_UNKNOWN;
+	for (i = 0; i < ARRAY_SIZE(C_tokens); i++) {
+		op = C_tokens[i].operator;
+		len = strlen(op);
+		state_type[SYMBOL_STATE + i] = TOK_SYMBOL + i;
+		if (strchr(SINGLE_SYMBOLS, *op))
+			continue;
+		for (j = 0; j < ARRAY_SIZE(C_tokens); j++) {
+			if ((int) strlen(C_tokens[j].operator) == len + 1 &&
+			    !strncmp(op, C_tokens[j].operator, len)) {
+				c = char_class[(unsigned char) C_tokens[j].operator[len]];
+				lex_table[SYMBOL_STATE + i][c] = SYMBOL_STATE + j;
+			}
+		}
+	}
+
+	/* Comments can start right after any character */
+	state = SYMBOL_STATE + find_symbol("/", 1);
+	lex_table[state][char_class['/']] = LINE_COMMENT;
+	lex_table[state][char_class['*']] = BLOCK_COMMENT;
+
+	init_keywords();
+	init_number();
+}
+
+/*
+ * Takes in a token type and returns the name to print for it.
+ * Returns NULL for tokens we could not find a type for.
+ */
+const char *token_name(int type)
+{
+	switch (type) {
+	case TOK_UNKNOWN:
+		return NULL;
+	case TOK_WORD:
+		return "word";
+	case TOK_DECIMAL:
+		return "decimal integer";
+	case TOK_OCTAL:
+		return "octal integer";
+	case TOK_HEX:
+		return "hex integer";
+	case TOK_FLOAT:
+		return "float";
+	case TOK_STRING:
+		return "string";
+	case TOK_CHAR:
+		return "character";
+	}
+	if (type >= TOK_KEYWORD)
+		return C_keywords[type - TOK_KEYWORD].name;
+	return C_tokens[type - TOK_SYMBOL].name;
+}
+
+/*
+ * Runs the lexer over the unread part of the buffer until it finds the end
+ * of a token, touching each byte once. Runs of white space, words, comments
+ * and the insides of string and character literals are scanned over in bulk
+ * by the scanners in scan.c, since the state does not change until the run
+ * ends. The token found is filled in fully typed. If more input is still to
+ * come, a token running into the end of the buffer is left alone and
+ * lex->pos is set back to the start of it so it can be lexed again once the
+ * rest of it is read in.
+ * Returns 1 if a token was found, 0 once the buffer runs out.
+ */
+static int next_token(struct lexer *lex, struct token *tok)
+{
+	const unsigned char *data = (const unsigned char *) lex->data;
+	size_t pos = lex->pos, start = lex->start, end = lex->len;
+	int state = lex->state, entry;
+
+	while (pos < end) {
+		switch (state) {
+		case START:
+			pos = skip_space(lex->data, pos, end);
+			break;
+		case WORD:
+			pos = skip_alnum(lex->data, pos, end);
+			break;
+		case LINE_COMMENT:
+			pos = find_byte(lex->data, pos, end, '\n');
+			break;
+		case BLOCK_COMMENT:
+			pos = find_byte(lex->data, pos, end, '*');
+			break;
+		case STRING:
+			pos = find_any(lex->data, pos, end, '"', '\\', '\n');
+			break;
+		case CHAR:
+			pos = find_any(lex->data, pos, end, '\'', '\\', '\n');
+			break;
+		}
+		if (pos == end)
+			break;
+
+		entry = lex_table[state][char_class[data[pos]]];
+		if (entry & (LEX_EMIT | LEX_EMIT_BACK)) {
+			tok->length = pos - start - ((entry & LEX_EMIT_BACK) ? 1 : 0);
+			tok->type = state_type[state];
+			lex->start = (entry & LEX_START) ? pos : start;
+			lex->state = entry & LEX_STATE;
+			lex->pos = pos + 1;
+			break;
+		}
+		if (entry & LEX_START)
+			start = pos;
+		state = entry & LEX_STATE;
+		pos++;
+	}
+
+	if (pos == end) {
+		lex->pos = end;
+		lex->start = start;
+		lex->state = state;
+		if (state_type[state] == NOT_A_TOKEN)
+			return 0;
+		if (!lex->eof) {
+			/* The rest of this token may still be on its way */
+			lex->pos = start;
+			lex->state = START;
+			return 0;
+		}
+		tok->length = end - start;
+		tok->type = state_type[state];
+		lex->state = START;
+	}
+
+	/*
+	 * A word that ran into a bad UTF-8 character ends before it, and
+	 * lexing picks back up at the character, which comes out on its own
+	 * as an unknown token.
+	 */
+	if (tok->type == PARTIAL_WORD) {
+		for (pos = start + tok->length - 1; (data[pos] & 0xc0) == 0x80; pos--)
+			;
+		tok->type = TOK_UNKNOWN;
+		if (pos > start) {
+			tok->length = pos - start;
+			tok->type = TOK_WORD;
+			lex->pos = pos;
+			lex->state = START;
+		}
+	}
+
+	tok->text = lex->data + start;
+	tok->offset = lex->base + start;
+	count_lines(lex, start);
+	tok->line = lex->line;
+	tok->column = tok->offset - lex->line_start + 1;
+	lex->counted = start + tok->length; /* Tokens never hold a newline */
+	if (tok->type == TOK_WORD)
+		tok->type = word_type(tok->text, tok->length);
+	else if (tok->type >= TOK_DECIMAL && tok->type <= TOK_FLOAT)
+		decode_number(tok);
+	return 1;
+}
+
+/*
+ * Counts the newlines from where counting left off up to upto, so the line
+ * and line start are those of the byte at upto. What is in between is the
+ * white space and comments since the last token, which is usually only a
+ * byte or two and counted right here. Longer runs are counted in bulk with
+ * count_byte(), and only then is the last newline looked for.
+ */
+static void count_lines(struct lexer *lex, size_t upto)
+{
+	size_t pos, newlines;
+
+	if (upto - lex->counted < 16) {
+		for (pos = lex->counted; pos < upto; pos++) {
+			if (lex->data[pos] == '\n') {
+				lex->line++;
+				lex->line_start = lex->base + pos + 1;
+			}
+		}
+	} else if ((newlines = count_byte(lex->data, lex->counted, upto, '\n'))) {
+		lex->line += newlines;
+		for (pos = upto; lex->data[pos - 1] != '\n'; pos--)
+			;
+		lex->line_start = lex->base + pos;
+	}
+	lex->counted = upto;
+}
+
+/*
+ * Slides the unread part of the buffer to the front and fills the rest of
+ * it with the next read from the file. The buffer only ever grows when a
+ * single token will not fit in it, so memory use stays flat no matter how
+ * big the input is.
+ * Returns 0 on success, -1 if the read or growing the buffer failed.
+ */
+static int fill_buffer(struct lexer *lex)
+{
+	size_t nr, remaining = lex->len - lex->pos;
+	char *save;
+
+	/* Lines in the part being thrown away have to be counted first */
+	count_lines(lex, lex->pos);
+	memmove(lex->buf, lex->buf + lex->pos, remaining);
+	lex->base += lex->pos;
+	lex->len = remaining;
+	lex->pos = 0;
+	lex->counted = 0;
+
+	if (lex->len == lex->size) {
+		save = realloc(lex->buf, sizeof(char) * (lex->size * 2 + 1));
+		if (!save)
+			return -1;
+		lex->buf = save;
+		lex->data = save;
+		lex->size *= 2;
+	}
+
+	nr = fread(lex->buf + lex->len, sizeof(char), lex->size - lex->len, lex->fp);
+	if (nr < lex->size - lex->len) {
+		if (ferror(lex->fp))
+			return -1;
+		lex->eof = 1;
+	}
+	lex->len += nr;
+	lex->buf[lex->len] = '\0';
+	return 0;
+}
+
+/* Sets a lexer up to go over the len bytes at data */
+void lexer_init(struct lexer *lex, const char *data, size_t len)
+{
+	pthread_once(&tables_once, init_lexer);
+	memset(lex, 0, sizeof(*lex));
+	lex->data = data;
+	lex->len = len;
+	lex->size = len;
+	lex->eof = 1;
+	lex->line = 1;
+}
+
+/*
+ * Sets a lexer up to stream everything left in fp. The buffer is only
+ * allocated once the first token is asked for.
+ */
+void lexer_init_file(struct lexer *lex, FILE *fp)
+{
+	pthread_once(&tables_once, init_lexer);
+	memset(lex, 0, sizeof(*lex));
+	lex->fp = fp;
+	lex->line = 1;
+}
+
+/*
+ * Finds the next token in the lexer's input, reading more of the file in
+ * whenever the buffer runs out before a token is found. At the end of the
+ * input, lex->line and lex->line_start are left at the very end of it.
+ * A window of text in memory is left for the caller to move along.
+ * Returns 1 if a token was found, 0 at the end of the input or window and
+ * -1 on error.
+ */
+int lexer_next(struct lexer *lex, struct token *tok)
+{
+	while (!next_token(lex, tok)) {
+		if (lex->eof) {
+			count_lines(lex, lex->len);
+			return 0;
+		}
+		if (!lex->fp)
+			return 0;
+		if (!lex->buf) {
+			lex->size = READ_BUFFER_SIZE;
+			lex->buf = malloc(sizeof(char) * (lex->size + 1));
+			if (!lex->buf)
+				return -1;
+			lex->data = lex->buf;
+		}
+		if (fill_buffer(lex) < 0)
+			return -1;
+	}
+	return 1;
+}
+
+/* Frees up the lexer's buffer, if it had to make one */
+void lexer_finish(struct lexer *lex)
+{
+	free(lex->buf);
+	lex->buf = NULL;
+	lex->data = NULL;
+	lex->len = lex->pos = 0;
+}
@@ -0,0 +1,202 @@
+#ifndef _LEXER_H
+#define _LEXER_H
+
+#include <stddef.h> /* size_t */
+#include <stdio.h> /* FILE */
+
+/*
+ * Number of symbols and keywords the lexer knows about, the C_tokens and
+ * C_keywords tables in lexer.c have exactly this many entries.
+ */
+#define NUM_C_SYMBOLS 42
+#define NUM_C_KEYWORDS 31
+
+/*
+ * Token types. Words, numbers, string and character literals and unknown
+ * tokens get their own type, symbols and keywords are TOK_SYMBOL/TOK_KEYWORD
+ * plus their index into C_tokens or C_keywords. A literal still missing its
+ * closing quote at the end of the line is an unknown token.
+ */
+enum token_type {
+	TOK_UNKNOWN,
+	TOK_WORD,
+	TOK_DECIMAL,
+	TOK_OCTAL,
+	TOK_HEX,
+	TOK_FLOAT,
+	TOK_STRING,
+	TOK_CHAR,
+	TOK_SYMBOL,
+	TOK_KEYWORD = TOK_SYMBOL + NUM_C_SYMBOLS,
+	NUM_TOKEN_TYPES = TOK_KEYWORD + NUM_C_KEYWORDS
+};
+
+/*
+ * Token struct. Tokens are never copied out of the input, each one is just
+ * a span of it along with the type it was parsed as. Offset is from the
+ * start of the whole input, text points at the token in the lexer's input.
+ * When lexing a file, text is only good until the next call to lexer_next().
+ * Line and column are where the token starts, both counting from 1, with
+ * columns counted in bytes.
+ *
+ * Number tokens also come with their value, worked out while lexing:
+ * integer for decimal, octal and hex tokens and real for floats. Only the
+ * leading part of a number that is valid C counts, so "12." is 12 and "0x"
+ * is 0, and integers too big to fit come out as ULLONG_MAX. Value is left
+ * alone for every other type of token.
+ */
+struct token {
+	const char *text;
+	size_t offset;
+	unsigned int length;
+	int type;
+	unsigned int line;
+	unsigned int column;
+	union {
+		unsigned long long integer;
+		double real;
+	} value;
+};
+
+/*
+ * Lexer struct. Holds either a string already in memory or a window of a
+ * file being streamed in. Bytes before pos have already been tokenized,
+ * bytes in between pos and len still need to be looked at. The lexer's
+ * state and where its current token started are kept here so lexing can
+ * pick back up after the buffer is refilled. Base is how far into the
+ * whole input the start of the buffer is; it can be set after lexer_init()
+ * when lexing a piece of something bigger so offsets are into the whole.
+ * Newlines are counted up to counted in the buffer, line is the line that
+ * puts the lexer on and line_start is where that line starts in the whole
+ * input. A piece that does not start at the top of the input should have
+ * line and line_start set along with base. Clearing eof after lexer_init()
+ * makes the len bytes a window onto more text that follows them: tokens
+ * that could run past the window are held back until len is raised.
+ */
+struct lexer {
+	FILE *fp;
+	char *buf;
+	const char *data;
+	size_t base;
+	size_t size;
+	size_t len;
+	size_t pos;
+	size_t start;
+	size_t counted;
+	size_t line_start;
+	unsigned int line;
+	int state;
+	int eof;
+};
+
+/*
+ * Pull iterator over the tokens of some input. Set a lexer up with
+ * lexer_init() for len bytes already in memory or lexer_init_file() to
+ * stream them from fp, then call lexer_next() until it returns 0 and
+ * lexer_finish() to let go of the lexer's buffer. lexer_next() returns 1
+ * with the next token filled in, 0 at the end of the input (or of a
+ * window), or -1 with errno set if reading the file or growing the buffer
+ * failed.
+ * Nothing is allocated per token, and separate lexers can be used from
+ * separate threads at once.
+ */
+extern void lexer_init(struct lexer *, const char *data, size_t len);
+extern void lexer_init_file(struct lexer *, FILE *fp);
+extern int lexer_next(struct lexer *, struct token *);
+extern void lexer_finish(struct lexer *);
+
+/*
+ * Returns the name the tokenizer prints for a token type, or NULL for
+ * TOK_UNKNOWN tokens.
+ */
+extern const char *token_name(int type);
+
+/*
+ * Text that gets edited over and over, along with all of its tokens in
+ * order. The text and tokens are both kept in gap buffers (see relex.c),
+ * so use lexed_text_token() to get at them. The text and tokens belong to
+ * the lexed_text, token text pointers are only good until the next edit.
+ */
+struct lexed_text {
+	char *data;
+	size_t len;
+	size_t size;
+	size_t data_gap;
+	struct token *tokens;
+	size_t count;
+	size_t capacity;
+	size_t gap;
+	size_t shift;
+	unsigned int line_shift;
+	struct token *scratch;
+	size_t scratch_capacity;
+};
+
+/*
+ * Tokens an edit changed. Tokens first up to first + old_count were
+ * replaced by the tokens first up to first + new_count, every token after
+ * that is the same as before apart from being moved over.
+ */
+struct token_range {
+	size_t first;
+	size_t old_count;
+	size_t new_count;
+};
+
+/*
+ * Incremental lexing. lexed_text_init() copies len bytes of data and lexes
+ * all of it. lexed_text_edit() replaces the removed bytes at offset with
+ * len bytes of inserted text and only lexes again from the last token that
+ * could have been changed up to where the tokens start lining up with the
+ * old ones. The text is only moved around between the edit and the one
+ * before it, so the work done grows with the edit and not the text.
+ * Both return 0, or -1 with errno set if the edit is out of range or
+ * memory could not be allocated. lexed_text_token() fills in the i'th
+ * token and lexed_text_free() lets go of it all.
+ */
+extern int lexed_text_init(struct lexed_text *, const char *data, size_t len);
+extern int lexed_text_edit(struct lexed_text *, size_t offset, size_t removed,
+			   const char *inserted, size_t len, struct token_range *);
+extern void lexed_text_token(const struct lexed_text *, size_t i, struct token *);
+extern void lexed_text_free(struct lexed_text *);
+
+/* One interned name, NUL terminated, in the symbol table's arena */
+struct symbol {
+	const char *name;
+	unsigned int length;
+};
+
+/* Hash table slot, id is one more than the symbol's id so 0 means empty */
+struct symbol_slot {
+	unsigned int hash;
+	unsigned int id;
+};
+
+/*
+ * Symbol table that interns names (see symtab.c). symbols[id] is the name
+ * with that id, ids go from 0 up to count in the order names were first
+ * interned. The arena is a chain of blocks the names are copied into.
+ */
+struct symbol_table {
+	struct symbol_slot *slots;
+	size_t num_slots;
+	struct symbol *symbols;
+	size_t count;
+	size_t capacity;
+	struct arena_block *arena;
+	size_t arena_used;
+};
+
+/*
+ * Interning. symtab_init() sets up an empty table. symtab_intern() sets id
+ * to the id of the len byte name, giving it the next id if the table has
+ * not seen it before, and returns 0, or -1 with errno set if memory could
+ * not be allocated. Names are copied, so name does not have to outlive the
+ * call. symtab_free() lets go of the table and every name in it.
+ */
+extern void symtab_init(struct symbol_table *);
+extern int symtab_intern(struct symbol_table *, const char *name, unsigned int len,
+			 unsigned int *id);
+extern void symtab_free(struct symbol_table *);
+
+#endif /* _LEXER_H */
@@ -0,0 +1,469 @@
+/*
+ * Number literal decoding for the lexer.
+ * Decimal digits are turned into a value eight at a time with SWAR (SIMD
+ * within a register) tricks on a 64 bit word, the rest of the digits and
+ * octal and hex digits go one at a time. Floats are worked out from their
+ * digits as an integer w and a power of ten q. When both fit in a double
+ * exactly a single multiply or divide rounds correctly on its own (Clinger's
+ * fast path), otherwise w is multiplied by a 128 bit approximation of 5^q,
+ * which gives the right answer for all but a tiny number of inputs that it
+ * can tell apart (the Eisel-Lemire algorithm). Those and floats with more
+ * than 19 digits go to strtod().
+ */
+
+#include <limits.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "number.h"
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define HAVE_SWAR 1
+#else
+#define HAVE_SWAR 0
+#endif
+
+#ifdef __SIZEOF_INT128__
+#define HAVE_INT128 1
+__extension__ typedef unsigned __int128 uint128;
+#else
+#define HAVE_INT128 0
+#endif
+
+/* Most digits of a decimal that can never overflow an unsigned long long */
+#define SAFE_DIGITS 19
+
+/* Biggest power of ten a double holds exactly, and 2^53 */
+#define MAX_EXACT_POW10 22
+#define MAX_EXACT_INT (1ULL << 53)
+
+/*
+ * Powers of ten with a 128 bit approximation of 5^q. Anything under 10^-342
+ * rounds to 0 and anything over 10^308 is too big for a double.
+ */
+#define SMALLEST_POW10 (-342)
+#define LARGEST_POW10 308
+#define NUM_POW5 (LARGEST_POW10 - SMALLEST_POW10 + 1)
+
+/* Double layout */
+#define MANTISSA_BITS 52
+#define EXPONENT_BIAS 1023
+#define INFINITE_POWER 0x7ff
+
+/*
+ * Size of the big numbers used to work out the powers of five. 5^342 takes
+ * 795 bits and the biggest reciprocal needs 2 * 795 + 128 bits under the
+ * point, so 2^1760 has room for all of them.
+ */
+#define BIG_LIMBS 56
+#define RECIPROCAL_BITS (32 * (BIG_LIMBS - 1))
+
+/* Longest float that gets copied to the stack to hand to strtod() */
+#define FLOAT_BUFFER_SIZE 128
+
+static const double powers_of_ten[MAX_EXACT_POW10 + 1] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+/*
+ * 5^q for every q from SMALLEST_POW10 to LARGEST_POW10, shifted so the top
+ * bit of the high word is set and cut off at 128 bits. Negative powers are
+ * rounded up instead. High word first, generated by init_number().
+ */
+static uint64_t pow5[NUM_POW5][2];
+
+static double decode_float(const char *, size_t);
+static double eisel_lemire(uint64_t w, long q, int *ok);
+static double slow_float(const char *, size_t);
+static int bit_length(const uint32_t *);
+static int hex_digit(int c);
+static size_t count_digits(const char *, size_t);
+static unsigned long long decode_decimal(const char *, size_t);
+static void mul128(uint64_t a, uint64_t b, uint64_t *hi, uint64_t *lo);
+static void top_bits(const uint32_t *, uint64_t *out);
+#if HAVE_SWAR
+static int eight_digits(uint64_t val);
+static uint64_t parse_eight_digits(uint64_t val);
+#endif
+
+/*
+ * Purpose: Finds how many bits a big number takes up.
+ * Return Value: Position of the highest set bit plus one, 0 for zero.
+ */
+static int bit_length(const uint32_t *big)
+{
+	int i = BIG_LIMBS - 1, bits = 0;
+
+	while (i > 0 && !big[i])
+		i--;
+	while (bits < 32 && big[i] >> bits)
+		bits++;
+	return 32 * i + bits;
+}
+
+/*
+ * Purpose: Gets the top 128 bits of a big number, shifting it up first if
+ * it takes up less than that. High word goes in out[0].
+ */
+static void top_bits(const uint32_t *big, uint64_t *out)
+{
+	int len = bit_length(big), pos, i;
+
+	out[0] = out[1] = 0;
+	for (i = 0; i < 128; i++) {
+		pos = len - 1 - i;
+		out[0] = out[0] << 1 | out[1] >> 63;
+		out[1] <<= 1;
+		if (pos >= 0)
+			out[1] |= (big[pos / 32] >> (pos % 32)) & 1;
+	}
+}
+
+/*
+ * Purpose: Generates the power of five table. Positive powers are worked out
+ * exactly and cut down to 128 bits. For 5^-q the reciprocal 2^b / 5^q is
+ * floored and rounded up by one, with b picked so it comes out with at least
+ * 128 bits. Dividing 2^RECIPROCAL_BITS by 5 over and over floors to the same
+ * thing as dividing by 5^q once, so only one division by 5 is needed for
+ * each q.
+ */
+void init_number(void)
+{
+	uint32_t power[BIG_LIMBS] = {1}, recip[BIG_LIMBS] = {0}, shifted[BIG_LIMBS];
+	uint64_t cur, carry;
+	int q, i, z, shift, words, bits;
+
+	for (q = 0; q <= -SMALLEST_POW10; q++) {
+		if (q <= LARGEST_POW10)
+			top_bits(power, pow5[q - SMALLEST_POW10]);
+
+		if (q) {
+			/* recip is floor(2^RECIPROCAL_BITS / 5^q) */
+			z = bit_length(power);
+			shift = RECIPROCAL_BITS - (q <= 27 ? z + 127 : 2 * z + 128);
+			words = shift / 32;
+			bits = shift % 32;
+			for (i = 0; i < BIG_LIMBS; i++) {
+				shifted[i] = i + words < BIG_LIMBS ? recip[i + words] >> bits : 0;
+				if (bits && i + words + 1 < BIG_LIMBS)
+					shifted[i] |= recip[i + words + 1] << (32 - bits);
+			}
+			for (i = 0; i < BIG_LIMBS && !++shifted[i]; i++)
+				;
+			top_bits(shifted, pow5[-q - SMALLEST_POW10]);
+		} else {
+			recip[RECIPROCAL_BITS / 32] = 1;
+		}
+
+		for (i = BIG_LIMBS - 1, carry = 0; i >= 0; i--) {
+			cur = carry << 32 | recip[i];
+			recip[i] = cur / 5;
+			carry = cur % 5;
+		}
+		for (i = 0, carry = 0; i < BIG_LIMBS; i++) {
+			cur = (uint64_t) power[i] * 5 + carry;
+			power[i] = (uint32_t) cur;
+			carry = cur >> 32;
+		}
+	}
+}
+
+/*
+ * Purpose: Multiplies two 64 bit numbers into a 128 bit one.
+ */
+static void mul128(uint64_t a, uint64_t b, uint64_t *hi, uint64_t *lo)
+{
+#if HAVE_INT128
+	uint128 product = (uint128) a * b;
+
+	*hi = (uint64_t) (product >> 64);
+	*lo = (uint64_t) product;
+#else
+	uint64_t a_lo = a & 0xffffffff, a_hi = a >> 32;
+	uint64_t b_lo = b & 0xffffffff, b_hi = b >> 32;
+	uint64_t p0 = a_lo * b_lo, p1 = a_lo * b_hi, p2 = a_hi * b_lo;
+	uint64_t mid = (p0 >> 32) + (p1 & 0xffffffff) + (p2 & 0xffffffff);
+
+	*lo = mid << 32 | (p0 & 0xffffffff);
+	*hi = a_hi * b_hi + (p1 >> 32) + (p2 >> 32) + (mid >> 32);
+#endif
+}
+
+/*
+ * Purpose: Works out w * 10^q rounded to the nearest double, for w that is
+ * not 0 and q from SMALLEST_POW10 to LARGEST_POW10. The top 64 bits of w
+ * times 5^q hold 10 more bits than a double needs, so unless those are all
+ * ones (the low 64 bits could carry into them) the rounding is known. In
+ * that case the next 64 bits of 5^q are used as well. The power of two is
+ * estimated from q as q * log2(10), which is exact over this range.
+ * Return Value: The double. ok is set to 0 if the product still lands too
+ * close to halfway between two doubles to tell which one it rounds to.
+ */
+static double eisel_lemire(uint64_t w, long q, int *ok)
+{
+	const uint64_t *power = pow5[q - SMALLEST_POW10];
+	uint64_t hi, lo, hi2, lo2, mantissa, bits;
+	int lz = __builtin_clzll(w), upper, shift;
+	long power2;
+	double val;
+
+	*ok = 1;
+	w <<= lz;
+	mul128(w, power[0], &hi, &lo);
+	if ((hi & 0x1ff) == 0x1ff) {
+		mul128(w, power[1], &hi2, &lo2);
+		lo += hi2;
+		if (hi2 > lo)
+			hi++;
+	}
+	if (lo == UINT64_MAX && (q < -27 || q > 55)) {
+		*ok = 0;
+		return 0.0;
+	}
+
+	upper = (int) (hi >> 63);
+	shift = upper + 64 - MANTISSA_BITS - 3;
+	mantissa = hi >> shift;
+	power2 = ((217706 * q) >> 16) + 63 + upper - lz + EXPONENT_BIAS;
+
+	if (power2 <= 0) {
+		/* Subnormal, or rounds all the way down to 0 */
+		if (-power2 + 1 >= 64)
+			return 0.0;
+		mantissa >>= -power2 + 1;
+		mantissa += mantissa & 1;
+		mantissa >>= 1;
+		power2 = mantissa < (1ULL << MANTISSA_BITS) ? 0 : 1;
+	} else {
+		/* Exactly halfway rounds to even, which is only possible for small q */
+		if (lo <= 1 && q >= -4 && q <= 23 && (mantissa & 3) == 1 &&
+		    mantissa << shift == hi)
+			mantissa &= ~1ULL;
+		mantissa += mantissa & 1;
+		mantissa >>= 1;
+		if (mantissa >= 2ULL << MANTISSA_BITS) {
+			mantissa = 1ULL << MANTISSA_BITS;
+			power2++;
+		}
+		mantissa &= ~(1ULL << MANTISSA_BITS);
+		if (power2 >= INFINITE_POWER)
+			return HUGE_VAL;
+	}
+
+	bits = mantissa | (uint64_t) power2 << MANTISSA_BITS;
+	memcpy(&val, &bits, sizeof(val));
+	return val;
+}
+
+#if HAVE_SWAR
+/*
+ * Purpose: Checks whether the 8 bytes loaded into val are all digits. Adding
+ * 6 to a digit keeps its high nibble at 3, anything else changes one of the
+ * two high nibbles away from 3.
+ * Return Value: Non-zero if all 8 are digits.
+ */
+static int eight_digits(uint64_t val)
+{
+	return (((val & 0xF0F0F0F0F0F0F0F0ULL) |
+		 (((val + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL) >> 4)) ==
+		0x3333333333333333ULL);
+}
+
+/*
+ * Purpose: Turns 8 digits loaded into val (first digit in the low byte) into
+ * their value by combining neighbouring pairs of digits, then pairs of pairs,
+ * then the two halves, with one multiply each.
+ * Return Value: The value of the 8 digits.
+ */
+static uint64_t parse_eight_digits(uint64_t val)
+{
+	val = ((val & 0x0F0F0F0F0F0F0F0FULL) * 2561) >> 8;
+	val = ((val & 0x00FF00FF00FF00FFULL) * 6553601) >> 16;
+	return ((val & 0x0000FFFF0000FFFFULL) * 42949672960001ULL) >> 32;
+}
+#endif
+
+/*
+ * Purpose: Finds how many decimal digits a string starts with, checking 8
+ * at a time while there are at least 8 bytes left.
+ * Return Value: The number of digits, at most len.
+ */
+static size_t count_digits(const char *str, size_t len)
+{
+	size_t i = 0;
+#if HAVE_SWAR
+	uint64_t word;
+
+	for (; i + 8 <= len; i += 8) {
+		memcpy(&word, str + i, sizeof(word));
+		if (!eight_digits(word))
+			break;
+	}
+#endif
+	while (i < len && str[i] >= '0' && str[i] <= '9')
+		i++;
+	return i;
+}
+
+/*
+ * Purpose: Decodes len decimal digits. Runs longer than SAFE_DIGITS are
+ * checked for overflow one digit at a time.
+ * Return Value: The value, or ULLONG_MAX if it does not fit.
+ */
+static unsigned long long decode_decimal(const char *str, size_t len)
+{
+	unsigned long long val = 0;
+	size_t i = 0;
+#if HAVE_SWAR
+	uint64_t word;
+#endif
+
+	if (len > SAFE_DIGITS) {
+		for (; i < len; i++) {
+			if (val > (ULLONG_MAX - (str[i] - '0')) / 10)
+				return ULLONG_MAX;
+			val = val * 10 + (str[i] - '0');
+		}
+		return val;
+	}
+#if HAVE_SWAR
+	for (; i + 8 <= len; i += 8) {
+		memcpy(&word, str + i, sizeof(word));
+		val = val * 100000000 + parse_eight_digits(word);
+	}
+#endif
+	for (; i < len; i++)
+		val = val * 10 + (str[i] - '0');
+	return val;
+}
+
+/*
+ * Purpose: Finds the value of one hex digit.
+ * Return Value: The value, or -1 if c is not a hex digit.
+ */
+static int hex_digit(int c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	return -1;
+}
+
+/*
+ * Purpose: Decodes the first len bytes of a float with strtod(). Tokens are
+ * not NUL terminated, so they get copied out first.
+ * Return Value: The value of the float.
+ */
+static double slow_float(const char *str, size_t len)
+{
+	char buf[FLOAT_BUFFER_SIZE], *copy = buf;
+	double val;
+
+	if (len >= FLOAT_BUFFER_SIZE && !(copy = malloc(len + 1))) {
+		copy = buf;
+		len = FLOAT_BUFFER_SIZE - 1;
+	}
+	memcpy(copy, str, len);
+	copy[len] = '\0';
+	val = strtod(copy, NULL);
+	if (copy != buf)
+		free(copy);
+	return val;
+}
+
+/*
+ * Purpose: Decodes a float of the form digits[.digits][e[+-]digits] from the
+ * start of a token, the digits making up w and the dot and exponent q.
+ * Return Value: The value of the float.
+ */
+static double decode_float(const char *str, size_t len)
+{
+	unsigned long long w = 0;
+	size_t i = 0, digits = 0, exp_start;
+	long q = 0, exp_val = 0;
+	int exp_neg = 0, ok;
+	double val;
+
+	/* Leading zeros do not count towards the 19 digits w can hold */
+	for (; i < len && str[i] >= '0' && str[i] <= '9'; i++) {
+		if (digits || str[i] != '0')
+			digits++;
+		w = w * 10 + (str[i] - '0');
+	}
+	if (i < len && str[i] == '.') {
+		for (i++; i < len && str[i] >= '0' && str[i] <= '9'; i++) {
+			if (digits || str[i] != '0')
+				digits++;
+			w = w * 10 + (str[i] - '0');
+			q--;
+		}
+	}
+
+	/* An exponent only counts if it has at least one digit */
+	if (i < len && (str[i] == 'e' || str[i] == 'E')) {
+		exp_start = i++;
+		if (i < len && (str[i] == '+' || str[i] == '-'))
+			exp_neg = str[i++] == '-';
+		if (i < len && str[i] >= '0' && str[i] <= '9') {
+			for (; i < len && str[i] >= '0' && str[i] <= '9'; i++) {
+				if (exp_val < 100000)
+					exp_val = exp_val * 10 + (str[i] - '0');
+			}
+			q += exp_neg ? -exp_val : exp_val;
+		} else {
+			i = exp_start;
+		}
+	}
+
+	/* i is now how much of the token makes up the float */
+	if (digits > SAFE_DIGITS)
+		return slow_float(str, i);
+	if (!w || q < SMALLEST_POW10)
+		return 0.0;
+	if (q > LARGEST_POW10)
+		return HUGE_VAL;
+	if (w <= MAX_EXACT_INT && q >= -MAX_EXACT_POW10 && q <= MAX_EXACT_POW10) {
+		val = (double) w;
+		return q < 0 ? val / powers_of_ten[-q] : val * powers_of_ten[q];
+	}
+	val = eisel_lemire(w, q, &ok);
+	return ok ? val : slow_float(str, i);
+}
+
+void decode_number(struct token *tok)
+{
+	const char *str = tok->text;
+	unsigned long long val = 0;
+	size_t i;
+	int digit;
+
+	switch (tok->type) {
+	case TOK_DECIMAL:
+		tok->value.integer = decode_decimal(str, count_digits(str, tok->length));
+		break;
+	case TOK_OCTAL:
+		for (i = 1; i < tok->length && val <= ULLONG_MAX >> 3; i++)
+			val = val << 3 | (str[i] - '0');
+		tok->value.integer = i < tok->length ? ULLONG_MAX : val;
+		break;
+	case TOK_HEX:
+		for (i = 2; i < tok->length && (digit = hex_digit(str[i])) >= 0; i++) {
+			if (val > ULLONG_MAX >> 4) {
+				val = ULLONG_MAX;
+				break;
+			}
+			val = val << 4 | digit;
+		}
+		tok->value.integer = val;
+		break;
+	case TOK_FLOAT:
+		tok->value.real = decode_float(str, tok->length);
+		break;
+	}
+}
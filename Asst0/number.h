@@ -0,0 +1,18 @@
+#ifndef _NUMBER_H
+#define _NUMBER_H
+
+#include "lexer.h"
+
+/*
+ * Decodes the value of a number token into tok->value, as an integer for
+ * decimal, octal and hex tokens or a double for floats. Only the part of
+ * the token that makes up a valid number is used, the same way strtoull()
+ * and strtod() stop at the first byte that does not fit. Integers too big
+ * for an unsigned long long come out as ULLONG_MAX.
+ */
+extern void decode_number(struct token *tok);
+
+/* Generates the tables decode_number() needs, called from init_lexer() */
+extern void init_number(void);
+
+#endif /* _NUMBER_H */
@@ -0,0 +1,358 @@
+/*
+ * Incremental Lexing.
+ * Authors: Christopher Naporlee && Michael Nelli
+ * CS214 Systems Programming | Section 5
+ * Description:
+ * 	Keeps the tokens of a text up to date as it gets edited, without
+ * 	lexing all of it again. This works because the lexer is always back
+ * 	to where it would be from START right where a token ends, so lexing
+ * 	can pick back up at any token's end, and once it finds a token that
+ * 	starts where an old token past the edit starts, every token from
+ * 	there on has to be the same as before.
+ *
+ * 	The tokens are kept in a gap buffer so an edit does not have to move
+ * 	every token after it. Tokens after the gap keep the offsets they
+ * 	had, and how much the text has grown or shrunk in front of them is
+ * 	kept in shift and only added on when they are looked at or moved
+ * 	back in front of the gap. Edits near each other only move the gap
+ * 	over a few tokens. Lines work the same way, with line_shift. The
+ * 	only other tokens an edit changes are those on the rest of the line
+ * 	the edit ends on, which get their columns moved over.
+ *
+ * 	The text is kept in a gap buffer too, with the gap moved to where
+ * 	each edit goes, so an edit only moves the bytes in between it and
+ * 	the last one. Lexing goes over the text in front of the gap, and the
+ * 	gap is only slid further along as far as lexing has to go.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lexer.h"
+
+/* Number of tokens a token array starts out with room for */
+#define TOKEN_ARRAY_SIZE 256
+
+/* Number of bytes the text buffer starts out with room for */
+#define TEXT_BUFFER_SIZE 4096
+
+/* Fewest bytes the text gap is slid along by when lexing runs into it */
+#define TEXT_WINDOW_SIZE 256
+
+/* Index in the token array of the i'th token, skipping over the gap */
+#define TOKEN_SLOT(text, i) \
+	((i) < (text)->gap ? (i) : (i) + (text)->capacity - (text)->count)
+
+static int grow_gap(struct lexed_text *, size_t need);
+static int grow_scratch(struct lexed_text *, size_t count);
+static int grow_text(struct lexed_text *, size_t need);
+static int same_token(const struct token *, const struct token *);
+static size_t first_changed(const struct lexed_text *, size_t offset);
+static size_t token_offset(const struct lexed_text *, size_t i);
+static void move_gap(struct lexed_text *, size_t to);
+static void move_text_gap(struct lexed_text *, size_t to);
+
+/* Returns where the i'th token starts in the text */
+static size_t token_offset(const struct lexed_text *text, size_t i)
+{
+	const struct token *tok = &text->tokens[TOKEN_SLOT(text, i)];
+
+	return i < text->gap ? tok->offset : tok->offset + text->shift;
+}
+
+/*
+ * Moves the gap so it is right before the token at index to, fixing up
+ * the offsets of the tokens that cross over it.
+ */
+static void move_gap(struct lexed_text *text, size_t to)
+{
+	size_t gap_len = text->capacity - text->count;
+	struct token *tok;
+
+	while (text->gap > to) {
+		text->gap--;
+		tok = &text->tokens[text->gap + gap_len];
+		*tok = text->tokens[text->gap];
+		tok->offset -= text->shift;
+		tok->line -= text->line_shift;
+	}
+	while (text->gap < to) {
+		tok = &text->tokens[text->gap];
+		*tok = text->tokens[text->gap + gap_len];
+		tok->offset += text->shift;
+		tok->line += text->line_shift;
+		text->gap++;
+	}
+}
+
+/*
+ * Makes sure there is room for at least need tokens in the gap.
+ * Returns 0 on success, -1 if the token array could not be grown.
+ */
+static int grow_gap(struct lexed_text *text, size_t need)
+{
+	struct token *save;
+	size_t size = text->capacity ? text->capacity : TOKEN_ARRAY_SIZE;
+	size_t after = text->count - text->gap;
+
+	if (text->capacity - text->count >= need)
+		return 0;
+	while (size - text->count < need)
+		size *= 2;
+	save = realloc(text->tokens, sizeof(*save) * size);
+	if (!save)
+		return -1;
+
+	/* Tokens after the gap go to the end of the bigger array */
+	if (after)
+		memmove(save + size - after, save + text->capacity - after,
+			sizeof(*save) * after);
+	text->tokens = save;
+	text->capacity = size;
+	return 0;
+}
+
+/*
+ * Moves the text's gap so it is right before the byte at offset to, moving
+ * only the bytes in between where it was and where it goes.
+ */
+static void move_text_gap(struct lexed_text *text, size_t to)
+{
+	size_t gap_len = text->size - text->len;
+
+	if (to < text->data_gap)
+		memmove(text->data + to + gap_len, text->data + to, text->data_gap - to);
+	else if (to > text->data_gap)
+		memmove(text->data + text->data_gap, text->data + text->data_gap + gap_len,
+			to - text->data_gap);
+	text->data_gap = to;
+}
+
+/*
+ * Makes sure there is room for at least need bytes in the text's gap.
+ * Returns 0 on success, -1 if the text buffer could not be grown.
+ */
+static int grow_text(struct lexed_text *text, size_t need)
+{
+	char *save;
+	size_t size = text->size ? text->size : TEXT_BUFFER_SIZE;
+	size_t after = text->len - text->data_gap;
+
+	if (text->size && text->size - text->len >= need)
+		return 0;
+	while (size - text->len < need)
+		size *= 2;
+	save = realloc(text->data, sizeof(char) * size);
+	if (!save)
+		return -1;
+
+	/* Text after the gap goes to the end of the bigger buffer */
+	if (after)
+		memmove(save + size - after, save + text->size - after, after);
+	text->data = save;
+	text->size = size;
+	return 0;
+}
+
+/*
+ * Makes sure the scratch array has room for at least count tokens.
+ * Returns 0 on success, -1 if it could not be grown.
+ */
+static int grow_scratch(struct lexed_text *text, size_t count)
+{
+	struct token *save;
+	size_t size = text->scratch_capacity ? text->scratch_capacity : TOKEN_ARRAY_SIZE;
+
+	if (count <= text->scratch_capacity)
+		return 0;
+	while (size < count)
+		size *= 2;
+	save = realloc(text->scratch, sizeof(*save) * size);
+	if (!save)
+		return -1;
+	text->scratch = save;
+	text->scratch_capacity = size;
+	return 0;
+}
+
+/*
+ * Returns 1 if two tokens are the same span of the same type at the same
+ * line and column, 0 if not.
+ */
+static int same_token(const struct token *a, const struct token *b)
+{
+	return a->offset == b->offset && a->length == b->length && a->type == b->type &&
+	       a->line == b->line && a->column == b->column;
+}
+
+/*
+ * Finds the first token an edit at offset could change. The lexer decides
+ * where a token ends by looking at most four bytes past the end of it (a
+ * word followed by a UTF-8 character that turns out to be bad on its
+ * fourth byte), so only tokens that end at least four bytes before the
+ * edit are known to be safe.
+ * Returns the index of the first token that is not.
+ */
+static size_t first_changed(const struct lexed_text *text, size_t offset)
+{
+	size_t lo = 0, hi = text->count, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (token_offset(text, mid) +
+		    text->tokens[TOKEN_SLOT(text, mid)].length + 3 < offset)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+int lexed_text_init(struct lexed_text *text, const char *data, size_t len)
+{
+	struct token_range changed;
+
+	memset(text, 0, sizeof(*text));
+	return lexed_text_edit(text, 0, 0, data, len, &changed);
+}
+
+void lexed_text_token(const struct lexed_text *text, size_t i, struct token *tok)
+{
+	*tok = text->tokens[TOKEN_SLOT(text, i)];
+	tok->offset = token_offset(text, i);
+	tok->text = text->data + tok->offset;
+	if (tok->offset >= text->data_gap)
+		tok->text += text->size - text->len;
+	if (i >= text->gap)
+		tok->line += text->line_shift;
+}
+
+int lexed_text_edit(struct lexed_text *text, size_t offset, size_t removed,
+		    const char *inserted, size_t len, struct token_range *changed)
+{
+	struct lexer lex;
+	struct token tok, old_tok;
+	size_t first, old, i, restart = 0, line_start = 0, count = 0, window;
+	unsigned int line = 1, old_line, line_shift = 0, column_shift = 0;
+	int lined_up = 0;
+
+	if (offset > text->len || removed > text->len - offset) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	/*
+	 * Move the gap to the edit, let it swallow the removed text and fill
+	 * the inserted text in at the front of it.
+	 */
+	if (grow_text(text, len > removed ? len - removed : 0) < 0)
+		return -1;
+	move_text_gap(text, offset);
+	text->len -= removed;
+	if (len)
+		memcpy(text->data + offset, inserted, len);
+	text->data_gap += len;
+	text->len += len;
+
+	/* Lexing picks back up at the end of the last token known to be safe */
+	first = first_changed(text, offset);
+	if (first) {
+		lexed_text_token(text, first - 1, &tok);
+		restart = tok.offset + tok.length;
+		line = tok.line;
+		line_start = tok.offset - (tok.column - 1);
+	}
+
+	/* Old tokens from here on start after the edit, if any still match */
+	for (old = first; old < text->count && token_offset(text, old) < offset + removed; old++)
+		;
+
+	/*
+	 * Only the text in front of the gap can be lexed, so the gap is slid
+	 * along whenever lexing runs into it, by at least as much as has been
+	 * lexed so far so tokens do not get lexed over and over.
+	 */
+	lexer_init(&lex, text->data + restart, text->data_gap - restart);
+	lex.base = restart;
+	lex.line = line;
+	lex.line_start = line_start;
+	lex.eof = text->data_gap == text->len;
+	for (;;) {
+		if (lexer_next(&lex, &tok) <= 0) {
+			if (lex.eof)
+				break;
+			window = lex.len < TEXT_WINDOW_SIZE ? TEXT_WINDOW_SIZE : lex.len;
+			move_text_gap(text, text->len - text->data_gap < window ?
+					    text->len : text->data_gap + window);
+			lex.len = text->data_gap - restart;
+			lex.eof = text->data_gap == text->len;
+			continue;
+		}
+		if (tok.offset >= offset + len) {
+			while (old < text->count &&
+			       token_offset(text, old) - removed + len < tok.offset)
+				old++;
+			lined_up = old < text->count &&
+				   token_offset(text, old) - removed + len == tok.offset;
+			if (lined_up) {
+				/* Lines and columns from here on move by the same amount */
+				lexed_text_token(text, old, &old_tok);
+				line_shift = tok.line - old_tok.line;
+				column_shift = tok.column - old_tok.column;
+
+				/* The gap goes back to where tokens line up again */
+				move_text_gap(text, tok.offset);
+				break;
+			}
+		}
+		if (grow_scratch(text, count + 1) < 0)
+			return -1;
+		text->scratch[count++] = tok;
+	}
+	if (!lined_up)
+		old = text->count;
+
+	/* Tokens that came out the same at the front did not really change */
+	for (i = 0; i < count && first < old; i++, first++) {
+		lexed_text_token(text, first, &old_tok);
+		if (!same_token(&text->scratch[i], &old_tok))
+			break;
+	}
+	changed->first = first;
+	changed->old_count = old - first;
+	changed->new_count = count - i;
+
+	/*
+	 * Drop the old tokens into the gap, fill the new ones in at the front
+	 * of it, and shift everything after by how much the text grew.
+	 */
+	move_gap(text, first);
+	text->count -= changed->old_count;
+	if (grow_gap(text, changed->new_count) < 0)
+		return -1;
+	if (changed->new_count)
+		memcpy(text->tokens + text->gap, text->scratch + i,
+		       sizeof(*text->tokens) * changed->new_count);
+	text->gap += changed->new_count;
+	text->count += changed->new_count;
+	text->shift += len - removed;
+	text->line_shift += line_shift;
+
+	/* Columns only change on the rest of the line the edit ends on */
+	if (column_shift) {
+		old_line = text->tokens[TOKEN_SLOT(text, text->gap)].line;
+		for (i = text->gap; i < text->count &&
+		     text->tokens[TOKEN_SLOT(text, i)].line == old_line; i++)
+			text->tokens[TOKEN_SLOT(text, i)].column += column_shift;
+	}
+	return 0;
+}
+
+void lexed_text_free(struct lexed_text *text)
+{
+	free(text->data);
+	free(text->tokens);
+	free(text->scratch);
+	memset(text, 0, sizeof(*text));
+}
@@ -0,0 +1,286 @@
+/*
+ * Character class scanning for the tokenizer.
+ * Each scanner comes in a plain C version that looks at one byte at a
+ * time, and on x86 in SSE2 and AVX2 versions that look at 16 or 32 bytes
+ * at a time. init_scan() picks the fastest version the running CPU has
+ * when the program starts, before anything can use them.
+ */
+
+#include <ctype.h>
+
+#include "scan.h"
+
+#if defined(__GNUC__) && defined(__SSE2__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_X86_SIMD 1
+#include <immintrin.h>
+#else
+#define HAVE_X86_SIMD 0
+#endif
+
+size_t (*skip_space)(const char *, size_t, size_t);
+size_t (*skip_alnum)(const char *, size_t, size_t);
+size_t (*find_byte)(const char *, size_t, size_t, int);
+size_t (*find_any)(const char *, size_t, size_t, int, int, int);
+size_t (*count_byte)(const char *, size_t, size_t, int);
+
+/*
+ * Purpose: Finds the end of a run of white space.
+ * Return Value: Position of the first byte that is not white space.
+ */
+static size_t skip_space_scalar(const char *data, size_t pos, size_t end)
+{
+	while (pos < end && isspace((unsigned char) data[pos]))
+		pos++;
+	return pos;
+}
+
+/*
+ * Purpose: Finds the end of a run of letters and numbers.
+ * Return Value: Position of the first byte that is not alphanumeric.
+ */
+static size_t skip_alnum_scalar(const char *data, size_t pos, size_t end)
+{
+	while (pos < end && isalnum((unsigned char) data[pos]))
+		pos++;
+	return pos;
+}
+
+/*
+ * Purpose: Finds the next byte equal to c.
+ * Return Value: Position of that byte.
+ */
+static size_t find_byte_scalar(const char *data, size_t pos, size_t end, int c)
+{
+	while (pos < end && data[pos] != (char) c)
+		pos++;
+	return pos;
+}
+
+/*
+ * Purpose: Finds the next byte equal to a, b or c.
+ * Return Value: Position of that byte.
+ */
+static size_t find_any_scalar(const char *data, size_t pos, size_t end, int a, int b, int c)
+{
+	while (pos < end && data[pos] != (char) a && data[pos] != (char) b &&
+	       data[pos] != (char) c)
+		pos++;
+	return pos;
+}
+
+/*
+ * Purpose: Counts the bytes equal to c.
+ * Return Value: The number of them in between pos and end.
+ */
+static size_t count_byte_scalar(const char *data, size_t pos, size_t end, int c)
+{
+	size_t count = 0;
+
+	for (; pos < end; pos++)
+		count += data[pos] == (char) c;
+	return count;
+}
+
+#if HAVE_X86_SIMD
+/*
+ * The vector versions build a mask with a bit set for every byte that is
+ * still part of the run, so the first clear bit is where the run ends.
+ * Ranges are checked with the unsigned min trick: x - lo is in range
+ * exactly when min(x - lo, hi - lo) == x - lo.
+ */
+#define IN_RANGE_128(v, lo, hi) \
+	_mm_cmpeq_epi8(_mm_min_epu8(_mm_sub_epi8(v, _mm_set1_epi8(lo)), \
+		_mm_set1_epi8((hi) - (lo))), _mm_sub_epi8(v, _mm_set1_epi8(lo)))
+#define IN_RANGE_256(v, lo, hi) \
+	_mm256_cmpeq_epi8(_mm256_min_epu8(_mm256_sub_epi8(v, _mm256_set1_epi8(lo)), \
+		_mm256_set1_epi8((hi) - (lo))), _mm256_sub_epi8(v, _mm256_set1_epi8(lo)))
+
+static size_t skip_space_sse2(const char *data, size_t pos, size_t end)
+{
+	__m128i v, space;
+	unsigned int mask;
+
+	for (; pos + 16 <= end; pos += 16) {
+		v = _mm_loadu_si128((const __m128i *) (const void *) (data + pos));
+		space = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')),
+				     IN_RANGE_128(v, '\t', '\r'));
+		mask = ~_mm_movemask_epi8(space) & 0xffff;
+		if (mask)
+			return pos + __builtin_ctz(mask);
+	}
+	return skip_space_scalar(data, pos, end);
+}
+
+static size_t skip_alnum_sse2(const char *data, size_t pos, size_t end)
+{
+	__m128i v, lower, alnum;
+	unsigned int mask;
+
+	for (; pos + 16 <= end; pos += 16) {
+		v = _mm_loadu_si128((const __m128i *) (const void *) (data + pos));
+		lower = _mm_or_si128(v, _mm_set1_epi8(0x20));
+		alnum = _mm_or_si128(IN_RANGE_128(lower, 'a', 'z'),
+				     IN_RANGE_128(v, '0', '9'));
+		mask = ~_mm_movemask_epi8(alnum) & 0xffff;
+		if (mask)
+			return pos + __builtin_ctz(mask);
+	}
+	return skip_alnum_scalar(data, pos, end);
+}
+
+static size_t find_byte_sse2(const char *data, size_t pos, size_t end, int c)
+{
+	__m128i v, needle = _mm_set1_epi8((char) c);
+	unsigned int mask;
+
+	for (; pos + 16 <= end; pos += 16) {
+		v = _mm_loadu_si128((const __m128i *) (const void *) (data + pos));
+		mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, needle));
+		if (mask)
+			return pos + __builtin_ctz(mask);
+	}
+	return find_byte_scalar(data, pos, end, c);
+}
+
+static size_t find_any_sse2(const char *data, size_t pos, size_t end, int a, int b, int c)
+{
+	__m128i v, match, needle_a = _mm_set1_epi8((char) a),
+		needle_b = _mm_set1_epi8((char) b), needle_c = _mm_set1_epi8((char) c);
+	unsigned int mask;
+
+	for (; pos + 16 <= end; pos += 16) {
+		v = _mm_loadu_si128((const __m128i *) (const void *) (data + pos));
+		match = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, needle_a),
+						  _mm_cmpeq_epi8(v, needle_b)),
+				     _mm_cmpeq_epi8(v, needle_c));
+		mask = _mm_movemask_epi8(match);
+		if (mask)
+			return pos + __builtin_ctz(mask);
+	}
+	return find_any_scalar(data, pos, end, a, b, c);
+}
+
+/* Counting uses the same mask, with a bit set for every match to add up */
+static size_t count_byte_sse2(const char *data, size_t pos, size_t end, int c)
+{
+	__m128i v, needle = _mm_set1_epi8((char) c);
+	size_t count = 0;
+
+	for (; pos + 16 <= end; pos += 16) {
+		v = _mm_loadu_si128((const __m128i *) (const void *) (data + pos));
+		count += __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(v, needle)));
+	}
+	return count + count_byte_scalar(data, pos, end, c);
+}
+
+__attribute__((target("avx2")))
+static size_t skip_space_avx2(const char *data, size_t pos, size_t end)
+{
+	__m256i v, space;
+	unsigned int mask;
+
+	for (; pos + 32 <= end; pos += 32) {
+		v = _mm256_loadu_si256((const __m256i *) (const void *) (data + pos));
+		space = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')),
+					IN_RANGE_256(v, '\t', '\r'));
+		mask = ~(unsigned int) _mm256_movemask_epi8(space);
+		if (mask)
+			return pos + __builtin_ctz(mask);
+	}
+	return skip_space_sse2(data, pos, end);
+}
+
+__attribute__((target("avx2")))
+static size_t skip_alnum_avx2(const char *data, size_t pos, size_t end)
+{
+	__m256i v, lower, alnum;
+	unsigned int mask;
+
+	for (; pos + 32 <= end; pos += 32) {
+		v = _mm256_loadu_si256((const __m256i *) (const void *) (data + pos));
+		lower = _mm256_or_si256(v, _mm256_set1_epi8(0x20));
+		alnum = _mm256_or_si256(IN_RANGE_256(lower, 'a', 'z'),
+					IN_RANGE_256(v, '0', '9'));
+		mask = ~(unsigned int) _mm256_movemask_epi8(alnum);
+		if (mask)
+			return pos + __builtin_ctz(mask);
+	}
+	return skip_alnum_sse2(data, pos, end);
+}
+
+__attribute__((target("avx2")))
+static size_t find_byte_avx2(const char *data, size_t pos, size_t end, int c)
+{
+	__m256i v, needle = _mm256_set1_epi8((char) c);
+	unsigned int mask;
+
+	for (; pos + 32 <= end; pos += 32) {
+		v = _mm256_loadu_si256((const __m256i *) (const void *) (data + pos));
+		mask = (unsigned int) _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, needle));
+		if (mask)
+			return pos + __builtin_ctz(mask);
+	}
+	return find_byte_sse2(data, pos, end, c);
+}
+
+__attribute__((target("avx2")))
+static size_t find_any_avx2(const char *data, size_t pos, size_t end, int a, int b, int c)
+{
+	__m256i v, match, needle_a = _mm256_set1_epi8((char) a),
+		needle_b = _mm256_set1_epi8((char) b), needle_c = _mm256_set1_epi8((char) c);
+	unsigned int mask;
+
+	for (; pos + 32 <= end; pos += 32) {
+		v = _mm256_loadu_si256((const __m256i *) (const void *) (data + pos));
+		match = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, needle_a),
+							_mm256_cmpeq_epi8(v, needle_b)),
+					_mm256_cmpeq_epi8(v, needle_c));
+		mask = (unsigned int) _mm256_movemask_epi8(match);
+		if (mask)
+			return pos + __builtin_ctz(mask);
+	}
+	return find_any_sse2(data, pos, end, a, b, c);
+}
+
+__attribute__((target("avx2,popcnt")))
+static size_t count_byte_avx2(const char *data, size_t pos, size_t end, int c)
+{
+	__m256i v, needle = _mm256_set1_epi8((char) c);
+	size_t count = 0;
+
+	for (; pos + 32 <= end; pos += 32) {
+		v = _mm256_loadu_si256((const __m256i *) (const void *) (data + pos));
+		count += __builtin_popcount(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, needle)));
+	}
+	return count + count_byte_sse2(data, pos, end, c);
+}
+#endif /* HAVE_X86_SIMD */
+
+/*
+ * Purpose: Points the scanners at the fastest versions this CPU can run.
+ * Return Value: None.
+ */
+__attribute__((constructor))
+static void init_scan(void)
+{
+	skip_space = skip_space_scalar;
+	skip_alnum = skip_alnum_scalar;
+	find_byte = find_byte_scalar;
+	find_any = find_any_scalar;
+	count_byte = count_byte_scalar;
+#if HAVE_X86_SIMD
+	skip_space = skip_space_sse2;
+	skip_alnum = skip_alnum_sse2;
+	find_byte = find_byte_sse2;
+	find_any = find_any_sse2;
+	count_byte = count_byte_sse2;
+	if (__builtin_cpu_supports("avx2")) {
+		skip_space = skip_space_avx2;
+		skip_alnum = skip_alnum_avx2;
+		find_byte = find_byte_avx2;
+		find_any = find_any_avx2;
+		if (__builtin_cpu_supports("popcnt"))
+			count_byte = count_byte_avx2;
+	}
+#endif
+}
@@ -0,0 +1,23 @@
+#ifndef _SCAN_H
+#define _SCAN_H
+
+#include <stddef.h> /* size_t */
+
+/*
+ * Scanners used by the lexer to get over long runs of bytes it does not
+ * need to look at one by one. Each one takes the input, the position to
+ * start at and the end of the input, and returns the position of the first
+ * byte that ends the run (or end if the run goes all the way).
+ * They point at the fastest version the CPU supports from the start.
+ */
+extern size_t (*skip_space)(const char *, size_t, size_t);
+extern size_t (*skip_alnum)(const char *, size_t, size_t);
+extern size_t (*find_byte)(const char *, size_t, size_t, int);
+
+/* Finds the next byte equal to any of a, b or c */
+extern size_t (*find_any)(const char *, size_t, size_t, int a, int b, int c);
+
+/* Counts how many bytes from pos up to end are equal to c */
+extern size_t (*count_byte)(const char *, size_t, size_t, int);
+
+#endif /* _SCAN_H */
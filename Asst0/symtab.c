@@ -0,0 +1,189 @@
+/*
+ * Symbol Table.
+ * Authors: Christopher Naporlee && Michael Nelli
+ * CS214 Systems Programming | Section 5
+ * Description:
+ * 	Interns identifiers, handing out a dense id for each distinct one
+ * 	in the order they are first seen. Each name is copied once into an
+ * 	arena made of big blocks that are only ever added to, so names never
+ * 	move and there is no per name allocation. Lookups go through an open
+ * 	addressing hash table of (hash, id) pairs, eight to a cache line,
+ * 	probed linearly. Names are only compared when the full hashes match,
+ * 	and the table is grown from the stored hashes without rehashing any
+ * 	names.
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lexer.h"
+
+/* Number of slots the hash table starts out with, has to be a power of 2 */
+#define SYMBOL_SLOTS 1024
+
+/* Number of symbols the symbol array starts out with room for */
+#define SYMBOL_ARRAY_SIZE 256
+
+/* Size of the blocks names are copied into */
+#define ARENA_BLOCK_SIZE 65536
+
+/* FNV-1a */
+#define HASH_BASIS 2166136261u
+#define HASH_PRIME 16777619u
+
+/*
+ * One block of the arena. Blocks are chained newest first so they can all
+ * be freed, names are packed into data one after the other.
+ */
+struct arena_block {
+	struct arena_block *next;
+	char data[];
+};
+
+static char *arena_copy(struct symbol_table *, const char *name, unsigned int len);
+static int grow_slots(struct symbol_table *);
+static unsigned int hash_name(const char *name, unsigned int len);
+
+/* Hashes a name with FNV-1a */
+static unsigned int hash_name(const char *name, unsigned int len)
+{
+	unsigned int hash = HASH_BASIS, i;
+
+	for (i = 0; i < len; i++)
+		hash = (hash ^ (unsigned char) name[i]) * HASH_PRIME;
+	return hash;
+}
+
+/*
+ * Doubles the number of hash table slots, putting every symbol back in by
+ * the hash it was stored with.
+ * Returns 0 on success, -1 if the new table could not be allocated.
+ */
+static int grow_slots(struct symbol_table *tab)
+{
+	struct symbol_slot *slots;
+	size_t num_slots = tab->num_slots ? tab->num_slots * 2 : SYMBOL_SLOTS;
+	size_t mask = num_slots - 1, i, j;
+
+	slots = calloc(num_slots, sizeof(*slots));
+	if (!slots)
+		return -1;
+	for (i = 0; i < tab->num_slots; i++) {
+		if (!tab->slots[i].id)
+			continue;
+		for (j = tab->slots[i].hash & mask; slots[j].id; j = (j + 1) & mask)
+			;
+		slots[j] = tab->slots[i];
+	}
+	free(tab->slots);
+	tab->slots = slots;
+	tab->num_slots = num_slots;
+	return 0;
+}
+
+/*
+ * Copies a name and a terminating NUL into the arena, starting a new block
+ * when the current one is full. Names too long for a block get a block all
+ * to themselves, which goes behind the current one so its space is not lost.
+ * Returns the copy, or NULL if a new block could not be allocated.
+ */
+static char *arena_copy(struct symbol_table *tab, const char *name, unsigned int len)
+{
+	struct arena_block *block;
+	char *copy;
+
+	if (len + 1 > ARENA_BLOCK_SIZE) {
+		block = malloc(sizeof(*block) + len + 1);
+		if (!block)
+			return NULL;
+		if (tab->arena) {
+			block->next = tab->arena->next;
+			tab->arena->next = block;
+		} else {
+			/* With no current block, this one goes in as a full one */
+			block->next = NULL;
+			tab->arena = block;
+			tab->arena_used = ARENA_BLOCK_SIZE;
+		}
+		copy = block->data;
+	} else {
+		if (!tab->arena || len + 1 > ARENA_BLOCK_SIZE - tab->arena_used) {
+			block = malloc(sizeof(*block) + ARENA_BLOCK_SIZE);
+			if (!block)
+				return NULL;
+			block->next = tab->arena;
+			tab->arena = block;
+			tab->arena_used = 0;
+		}
+		copy = tab->arena->data + tab->arena_used;
+		tab->arena_used += len + 1;
+	}
+	memcpy(copy, name, len);
+	copy[len] = '\0';
+	return copy;
+}
+
+void symtab_init(struct symbol_table *tab)
+{
+	memset(tab, 0, sizeof(*tab));
+}
+
+int symtab_intern(struct symbol_table *tab, const char *name, unsigned int len,
+		  unsigned int *id)
+{
+	struct symbol *save;
+	unsigned int hash = hash_name(name, len);
+	size_t mask, i, size;
+	const struct symbol *sym;
+
+	/* Keep the table at most half full so probe runs stay short */
+	if (tab->count * 2 >= tab->num_slots && grow_slots(tab) < 0)
+		return -1;
+	mask = tab->num_slots - 1;
+	for (i = hash & mask; tab->slots[i].id; i = (i + 1) & mask) {
+		if (tab->slots[i].hash != hash)
+			continue;
+		sym = &tab->symbols[tab->slots[i].id - 1];
+		if (sym->length == len && !memcmp(sym->name, name, len)) {
+			*id = tab->slots[i].id - 1;
+			return 0;
+		}
+	}
+
+	/* Not seen before, so it gets the next id */
+	if (tab->count == UINT_MAX - 1) {
+		errno = ENOSPC;
+		return -1;
+	}
+	if (tab->count == tab->capacity) {
+		size = tab->capacity ? tab->capacity * 2 : SYMBOL_ARRAY_SIZE;
+		save = realloc(tab->symbols, sizeof(*save) * size);
+		if (!save)
+			return -1;
+		tab->symbols = save;
+		tab->capacity = size;
+	}
+	tab->symbols[tab->count].name = arena_copy(tab, name, len);
+	if (!tab->symbols[tab->count].name)
+		return -1;
+	tab->symbols[tab->count].length = len;
+	tab->slots[i].hash = hash;
+	tab->slots[i].id = ++tab->count;
+	*id = tab->count - 1;
+	return 0;
+}
+
+void symtab_free(struct symbol_table *tab)
+{
+	struct arena_block *block, *next;
+
+	for (block = tab->arena; block; block = next) {
+		next = block->next;
+		free(block);
+	}
+	free(tab->slots);
+	free(tab->symbols);
+	memset(tab, 0, sizeof(*tab));
+}
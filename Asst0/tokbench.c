@@ -0,0 +1,443 @@
+/*
+ * Tokenizer Benchmark.
+ * Program Description:
+ * 	This program generates a few kinds of C-like source to tokenize and
+ * 	times the tokenizer on each of them in every one of its modes. For
+ * 	each run it reports throughput in MB/s and millions of tokens per
+ * 	second, how many allocations were made per token and the peak RSS.
+ * 	The tokenizer it runs has to be the benchmark build (see the bench
+ * 	target in the Makefile), which counts its own allocations.
+ *
+ * 	For example,
+ * 	./tokbench -s 32 -r 5 ./tokenizer_bench
+ */
+
+#include <err.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "lexer.h"
+
+#define ARRAY_SIZE(arr) ((int) (sizeof(arr)/sizeof(*(arr))))
+
+/* Default size of each generated corpus in MB, and runs per measurement */
+#define CORPUS_MB 16
+#define NUM_RUNS 3
+
+/* Most arguments any mode runs the tokenizer with, including the file */
+#define MAX_MODE_ARGS 6
+
+/* Generates size bytes of one kind of source into fp */
+typedef void (*corpus_gen)(FILE *, size_t);
+
+/* Kind of source to benchmark on and how to generate it */
+struct corpus {
+	const char *name;
+	corpus_gen gen;
+};
+
+/* Way of running the tokenizer, the file goes after the args */
+struct mode {
+	const char *name;
+	const char *args[MAX_MODE_ARGS];
+};
+
+/* What one run of the tokenizer cost */
+struct result {
+	double seconds;
+	long peak_rss;
+	unsigned long allocations;
+};
+
+double now(void);
+size_t emit(FILE *, const char *);
+unsigned int rng(void);
+void gen_comments(FILE *, size_t);
+void gen_identifiers(FILE *, size_t);
+void gen_numbers(FILE *, size_t);
+void gen_operators(FILE *, size_t);
+void gen_strings(FILE *, size_t);
+void print_result(const char *corpus, const char *mode, size_t bytes,
+		  size_t tokens, const struct result *);
+void run_tokenizer(const char *exe, const struct mode *, const char *file, struct result *);
+size_t count_tokens(const char *file, double *seconds);
+size_t emit_word(FILE *, int max_len);
+
+/* C keywords, sprinkled in among the identifiers */
+const char *keywords[] = {
+	"if", "else", "while", "for", "return", "int", "char", "unsigned",
+	"struct", "const", "static", "sizeof", "void", "switch", "case",
+};
+
+/* Operators the pathological corpus is strung together out of */
+const char *operators[] = {
+	">", ">>", ">>=", ">=", "<", "<<", "<<=", "<=", "=", "==", "!", "!=",
+	"&", "&&", "&=", "|", "||", "|=", "^", "^=", "+", "++", "+=", "-",
+	"--", "-=", "->", "*", "*=", "%", "%=", "~", "?", ":", ".",
+};
+
+/* What goes in between the words of a line of identifier heavy code */
+const char *separators[] = {
+	" = ", "(", ", ", ") ", "->", ".", " + ", "; ", "[", "] ", " * ",
+	" && ", " < ", ") {\n\t\t",
+};
+
+const struct corpus corpora[] = {
+	{"identifiers", gen_identifiers},
+	{"comments", gen_comments},
+	{"numbers", gen_numbers},
+	{"operators", gen_operators},
+	{"strings", gen_strings},
+};
+
+unsigned int rng_state = 2463534242u;
+
+/* Xorshift random numbers, so every run generates the same corpora */
+unsigned int rng(void)
+{
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 17;
+	rng_state ^= rng_state << 5;
+	return rng_state;
+}
+
+/* Returns the time in seconds on a clock that only ever goes forward */
+double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Writes str to fp. Returns how many bytes that was */
+size_t emit(FILE *fp, const char *str)
+{
+	fputs(str, fp);
+	return strlen(str);
+}
+
+/*
+ * Writes a random identifier of 1 to max_len characters to fp.
+ * Returns how many bytes that was.
+ */
+size_t emit_word(FILE *fp, int max_len)
+{
+	static const char first[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ_";
+	static const char rest[] = "abcdefghijklmnopqrstuvwxyz0123456789_";
+	int i, len = 1 + rng() % max_len;
+
+	fputc(first[rng() % (sizeof(first) - 1)], fp);
+	for (i = 1; i < len; i++)
+		fputc(rest[rng() % (sizeof(rest) - 1)], fp);
+	return len;
+}
+
+/* Statements made up mostly of identifiers with a keyword here and there */
+void gen_identifiers(FILE *fp, size_t size)
+{
+	size_t written = 0;
+	int i, n;
+
+	while (written < size) {
+		written += emit(fp, "\t");
+		n = 3 + rng() % 6;
+		for (i = 0; i < n; i++) {
+			if (rng() % 5 == 0)
+				written += emit(fp, keywords[rng() % ARRAY_SIZE(keywords)]);
+			else
+				written += emit_word(fp, 16);
+			if (i + 1 < n)
+				written += emit(fp, separators[rng() % ARRAY_SIZE(separators)]);
+		}
+		written += emit(fp, ";\n");
+	}
+}
+
+/* Long block and line comments with a little code in between them */
+void gen_comments(FILE *fp, size_t size)
+{
+	size_t written = 0;
+	int i, j, n;
+
+	while (written < size) {
+		switch (rng() % 3) {
+		case 0:
+			written += emit(fp, "/*\n");
+			n = 1 + rng() % 8;
+			for (i = 0; i < n; i++) {
+				written += emit(fp, " *");
+				for (j = 0; j < 10; j++) {
+					written += emit(fp, " ");
+					written += emit_word(fp, 10);
+				}
+				written += emit(fp, rng() % 4 ? ".\n" : " a->b * 2 = c;\n");
+			}
+			written += emit(fp, " */\n");
+			break;
+		case 1:
+			written += emit(fp, "// ");
+			for (j = 0; j < 12; j++) {
+				written += emit_word(fp, 10);
+				written += emit(fp, " ");
+			}
+			written += emit(fp, "\n");
+			break;
+		default:
+			written += emit(fp, "\t");
+			written += emit_word(fp, 12);
+			written += emit(fp, " = ");
+			written += emit_word(fp, 12);
+			written += emit(fp, " + 1; /* trailing comment */\n");
+			break;
+		}
+	}
+}
+
+/* Initializer lists of decimal, octal, hex and floating point numbers */
+void gen_numbers(FILE *fp, size_t size)
+{
+	static const char hex[] = "0123456789abcdefABCDEF";
+	char num[64];
+	size_t written = 0;
+	int i;
+
+	while (written < size) {
+		written += emit(fp, "\t");
+		for (i = 0; i < 8; i++) {
+			switch (rng() % 5) {
+			case 0:
+				sprintf(num, "%u", rng() % 1000000);
+				break;
+			case 1:
+				sprintf(num, "0%o", rng() % 65536);
+				break;
+			case 2:
+				sprintf(num, "0x%c%c%c%c", hex[rng() % 22], hex[rng() % 22],
+					hex[rng() % 22], hex[rng() % 22]);
+				break;
+			case 3:
+				sprintf(num, "%u.%u", rng() % 1000, rng() % 100000);
+				break;
+			default:
+				sprintf(num, "%u.%ue%c%u", rng() % 10, rng() % 1000,
+					rng() % 2 ? '+' : '-', rng() % 300);
+				break;
+			}
+			written += emit(fp, num);
+			written += emit(fp, i < 7 ? ", " : ",\n");
+		}
+	}
+}
+
+/*
+ * Long runs of operators with nothing in between, like ">>>>=", which make
+ * the lexer end a token on nearly every byte. '/' is left out so the runs
+ * never turn into comments.
+ */
+void gen_operators(FILE *fp, size_t size)
+{
+	size_t written = 0;
+	int i, n;
+
+	while (written < size) {
+		n = 30 + rng() % 30;
+		for (i = 0; i < n; i++)
+			written += emit(fp, operators[rng() % ARRAY_SIZE(operators)]);
+		written += emit(fp, "\n");
+	}
+}
+
+/*
+ * Calls passed long string literals full of words, escapes and things
+ * that look like comments, with a character literal here and there.
+ */
+void gen_strings(FILE *fp, size_t size)
+{
+	static const char *escapes[] = {"\\n", "\\t", "\\\"", "\\\\", "%d", "/*", "//"};
+	size_t written = 0;
+	int i, n;
+
+	while (written < size) {
+		written += emit(fp, "\tprintf(\"");
+		n = 4 + rng() % 16;
+		for (i = 0; i < n; i++) {
+			written += emit_word(fp, 10);
+			written += emit(fp, rng() % 4 ? " " : escapes[rng() % ARRAY_SIZE(escapes)]);
+		}
+		written += emit(fp, rng() % 2 ? "\", x);\n" : "\", '\\n');\n");
+	}
+}
+
+/*
+ * Runs the lexer library over a file without printing anything, which
+ * is as fast as any mode of the tokenizer can hope to go.
+ * Returns the number of tokens in the file, seconds is set to how long
+ * lexing them took.
+ */
+size_t count_tokens(const char *file, double *seconds)
+{
+	struct lexer lex;
+	struct token tok;
+	size_t count = 0;
+	FILE *fp;
+	double start;
+
+	if (!(fp = fopen(file, "r")))
+		err(1, "Cannot open '%s'", file);
+	start = now();
+	lexer_init_file(&lex, fp);
+	while (lexer_next(&lex, &tok) > 0)
+		count++;
+	lexer_finish(&lex);
+	*seconds = now() - start;
+	fclose(fp);
+	return count;
+}
+
+/*
+ * Runs the benchmark build of the tokenizer on a file in the given mode,
+ * throwing its output away. The allocation count comes from what
+ * benchwrap.c prints to stderr, peak RSS from the child's rusage.
+ */
+void run_tokenizer(const char *exe, const struct mode *mode, const char *file,
+		   struct result *res)
+{
+	char *argv[MAX_MODE_ARGS + 2];
+	struct rusage usage;
+	char report[128];
+	ssize_t nr;
+	double start;
+	pid_t pid;
+	int i, status, fds[2];
+
+	if (pipe(fds) < 0)
+		err(1, "Cannot make a pipe");
+	start = now();
+	if ((pid = fork()) < 0)
+		err(1, "Cannot fork");
+	if (!pid) {
+		close(fds[0]);
+		if ((i = open("/dev/null", O_WRONLY)) < 0)
+			err(1, "Cannot open /dev/null");
+		dup2(i, STDOUT_FILENO);
+		dup2(fds[1], STDERR_FILENO);
+
+		/* exec wants writable strings, copies are fine this late */
+		argv[0] = strdup(exe);
+		for (i = 0; mode->args[i]; i++)
+			argv[i + 1] = strdup(mode->args[i]);
+		argv[i + 1] = strdup(file);
+		argv[i + 2] = NULL;
+		execv(exe, argv);
+		err(1, "Cannot run '%s'", exe);
+	}
+
+	close(fds[1]);
+	nr = read(fds[0], report, sizeof(report) - 1);
+	report[nr > 0 ? nr : 0] = '\0';
+	close(fds[0]);
+	if (wait4(pid, &status, 0, &usage) < 0)
+		err(1, "Cannot wait for '%s'", exe);
+	res->seconds = now() - start;
+
+	if (!WIFEXITED(status) || WEXITSTATUS(status))
+		errx(1, "'%s %s' failed.", exe, mode->name);
+	if (sscanf(report, "allocations: %lu", &res->allocations) != 1)
+		errx(1, "'%s' did not count its allocations, is it the benchmark build?", exe);
+	res->peak_rss = usage.ru_maxrss;
+}
+
+/* Prints one line of the results table, peak_rss < 0 leaves out the costs */
+void print_result(const char *corpus, const char *mode, size_t bytes,
+		  size_t tokens, const struct result *res)
+{
+	printf("%-12s %-16s %9.1f %9.2f", corpus, mode,
+	       bytes / res->seconds / 1e6, tokens / res->seconds / 1e6);
+	if (res->peak_rss < 0)
+		printf(" %12s %10s\n", "-", "-");
+	else
+		printf(" %12.6f %8ld KB\n",
+		       tokens ? (double) res->allocations / tokens : 0.0, res->peak_rss);
+}
+
+int main(int argc, char **argv)
+{
+	char dir[] = "/tmp/tokbench.XXXXXX";
+	char file[sizeof(dir) + 32], threads[24], parallel[40];
+	struct mode modes[] = {
+		{"-f", {"-f"}},
+		{"-m", {"-m"}},
+		{"-o binary -m", {"-o", "binary", "-m"}},
+		{"-o stats -m", {"-o", "stats", "-m"}},
+		{parallel, {"-j", threads, "-m"}},
+	};
+	struct result res, best;
+	struct stat st;
+	size_t tokens;
+	long nproc;
+	int i, c, m, run, corpus_mb = CORPUS_MB, num_runs = NUM_RUNS;
+	FILE *fp;
+
+	/* Options come before the tokenizer to run */
+	for (i = 1; i + 1 < argc; i += 2) {
+		if (!strcmp(argv[i], "-s"))
+			corpus_mb = atoi(argv[i + 1]);
+		else if (!strcmp(argv[i], "-r"))
+			num_runs = atoi(argv[i + 1]);
+		else
+			break;
+	}
+	if (i + 1 != argc || corpus_mb <= 0 || num_runs <= 0)
+		errx(1, "Please input the benchmark build of the tokenizer to run.\n"
+			" Usage: ./tokbench [-s <MB per corpus>] [-r <runs>] <tokenizer>");
+
+	/* Parallel runs use every CPU, but always at least two threads */
+	nproc = sysconf(_SC_NPROCESSORS_ONLN);
+	sprintf(threads, "%ld", nproc > 2 ? nproc : 2);
+	sprintf(parallel, "-j %s -m", threads);
+
+	if (!mkdtemp(dir))
+		err(1, "Cannot make a directory for the corpora");
+	printf("%-12s %-16s %9s %9s %12s %10s\n", "corpus", "mode", "MB/s",
+	       "Mtok/s", "allocs/tok", "peak RSS");
+
+	for (c = 0; c < ARRAY_SIZE(corpora); c++) {
+		sprintf(file, "%s/%s.c", dir, corpora[c].name);
+		if (!(fp = fopen(file, "w")))
+			err(1, "Cannot create '%s'", file);
+		corpora[c].gen(fp, (size_t) corpus_mb << 20);
+		if (fclose(fp) || stat(file, &st) < 0)
+			err(1, "Cannot write '%s'", file);
+
+		/* The lexer on its own, and the token count for every mode */
+		best.seconds = 0;
+		for (run = 0; run < num_runs; run++) {
+			tokens = count_tokens(file, &res.seconds);
+			if (!run || res.seconds < best.seconds)
+				best.seconds = res.seconds;
+		}
+		best.peak_rss = -1;
+		print_result(corpora[c].name, "lexer only", st.st_size, tokens, &best);
+
+		for (m = 0; m < ARRAY_SIZE(modes); m++) {
+			for (run = 0; run < num_runs; run++) {
+				run_tokenizer(argv[i], &modes[m], file, &res);
+				if (!run || res.seconds < best.seconds)
+					best = res;
+			}
+			print_result(corpora[c].name, modes[m].name, st.st_size, tokens, &best);
+		}
+		unlink(file);
+	}
+	rmdir(dir);
+	return 0;
+}
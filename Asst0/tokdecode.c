@@ -0,0 +1,200 @@
+/*
+ * Token Stream Decoder.
+ * Program Description:
+ * 	This program reads back a binary token stream written by
+ * 	'tokenizer -o binary' and prints the tokens in it the same way the
+ * 	tokenizer prints them by default. Binary streams only hold where
+ * 	each token is, so the source they were made from is needed too.
+ * 	Either file can be '-' to read it from stdin. With '-l' each
+ * 	token is printed after the line and column it starts at.
+ *
+ * 	For example,
+ * 	./tokenizer -o binary -f source.c > source.tok
+ * 	./tokdecode source.tok source.c
+ * 	word: "int"
+ * 	...
+ * 	./tokdecode -l source.tok source.c
+ * 	1:1: word: "int"
+ * 	...
+ */
+
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tokstream.h"
+
+/* Size of the chunks files are read in and of the stdout buffer */
+#ifndef READ_BUFFER_SIZE
+#define READ_BUFFER_SIZE 65536
+#endif
+
+/* Binary token stream being decoded, pos is the next byte to decode */
+struct token_stream {
+	const unsigned char *data;
+	size_t len;
+	size_t pos;
+};
+
+char *read_file(const char *path, size_t *len);
+int get_position(struct token_stream *, size_t pos, size_t *line, size_t *line_start);
+int get_varint(struct token_stream *, size_t *);
+
+/*
+ * Reads all of a file into memory, or all of stdin if path is "-".
+ * Returns the contents, len is set to their length.
+ */
+char *read_file(const char *path, size_t *len)
+{
+	FILE *fp = stdin;
+	char *data = NULL, *save;
+	size_t size = 0, nr;
+
+	if (strcmp(path, "-") && !(fp = fopen(path, "rb")))
+		err(1, "Cannot open '%s'", path);
+
+	*len = 0;
+	do {
+		if (*len == size) {
+			size = size ? size * 2 : READ_BUFFER_SIZE;
+			save = realloc(data, sizeof(char) * size);
+			if (!save)
+				err(-1, "Error allocating memory.");
+			data = save;
+		}
+		nr = fread(data + *len, sizeof(char), size - *len, fp);
+		*len += nr;
+	} while (nr);
+
+	if (ferror(fp))
+		err(1, "Error reading '%s'", path);
+	if (fp != stdin)
+		fclose(fp);
+	return data;
+}
+
+/*
+ * Decodes the next varint in the stream into v.
+ * Returns 1 if one was decoded, 0 if the stream ran out first.
+ */
+int get_varint(struct token_stream *ts, size_t *v)
+{
+	unsigned int shift = 0;
+	unsigned char byte;
+
+	*v = 0;
+	do {
+		if (ts->pos == ts->len)
+			return 0;
+		if (shift >= 7 * VARINT_MAX_LEN)
+			errx(1, "Token stream has a varint that is too long.");
+		byte = ts->data[ts->pos++];
+		*v |= (size_t) (byte & 0x7f) << shift;
+		shift += 7;
+	} while (byte & 0x80);
+	return 1;
+}
+
+/*
+ * Decodes the line delta, and column if the line changed, of the record
+ * at pos in the source, updating the current line and where it starts.
+ * Returns 1 if they were decoded, 0 if the stream ran out first.
+ */
+int get_position(struct token_stream *ts, size_t pos, size_t *line, size_t *line_start)
+{
+	size_t delta, column;
+
+	if (!get_varint(ts, &delta))
+		return 0;
+	if (!delta)
+		return 1;
+	if (!get_varint(ts, &column))
+		return 0;
+	if (!column || column - 1 > pos)
+		errx(1, "Token stream has a column past the start of its line.");
+	*line += delta;
+	*line_start = pos - (column - 1);
+	return 1;
+}
+
+int main(int argc, char **argv)
+{
+	struct token_stream ts;
+	const char **names;
+	const char *end;
+	char *tokens, *source;
+	size_t src_len, num_types, type, gap, len, pos = 0, i;
+	size_t line = 0, line_start = 0;
+	int lines = argc == 4 && !strcmp(argv[1], "-l");
+
+	if (argc - lines != 3)
+		errx(1, "Please input a token stream and the source it was made from.\n"
+			" Usage: ./tokdecode [-l] <token stream | -> <source | ->");
+	argv += lines;
+
+	tokens = read_file(argv[1], &ts.len);
+	source = read_file(argv[2], &src_len);
+	ts.data = (const unsigned char *) tokens;
+	ts.pos = TOKSTREAM_MAGIC_LEN + 1;
+
+	if (ts.len < ts.pos || memcmp(tokens, TOKSTREAM_MAGIC, TOKSTREAM_MAGIC_LEN))
+		errx(1, "'%s' is not a token stream.", argv[1]);
+	if (tokens[TOKSTREAM_MAGIC_LEN] != TOKSTREAM_VERSION)
+		errx(1, "'%s' is a version %d token stream, only version %d is supported.",
+		     argv[1], tokens[TOKSTREAM_MAGIC_LEN], TOKSTREAM_VERSION);
+
+	/* The header names every token type the records can use */
+	if (!get_varint(&ts, &num_types) || num_types > ts.len)
+		errx(1, "Token stream header is cut off.");
+	names = malloc(sizeof(*names) * (num_types + 1));
+	if (!names)
+		err(-1, "Error allocating memory.");
+	for (i = 0; i < num_types; i++) {
+		names[i] = tokens + ts.pos;
+		end = memchr(names[i], '\0', ts.len - ts.pos);
+		if (!end)
+			errx(1, "Token stream header is cut off.");
+		ts.pos = end + 1 - tokens;
+	}
+
+	setvbuf(stdout, NULL, _IOFBF, READ_BUFFER_SIZE);
+	while (ts.pos < ts.len) {
+		if (!get_varint(&ts, &type) || !get_varint(&ts, &gap))
+			errx(1, "Token stream is cut off.");
+		if (gap > src_len - pos)
+			errx(1, "Token stream runs past the end of the source.");
+		pos += gap;
+		if (type == TOKSTREAM_SKIP) {
+			if (!get_position(&ts, pos, &line, &line_start))
+				errx(1, "Token stream is cut off.");
+			continue;
+		}
+
+		if (!get_varint(&ts, &len) || !get_position(&ts, pos, &line, &line_start))
+			errx(1, "Token stream is cut off.");
+		if (len > src_len - pos)
+			errx(1, "Token stream runs past the end of the source.");
+		if (type > num_types)
+			errx(1, "Token stream has a token of unknown type %lu.",
+			     (unsigned long) type - 1);
+
+		if (lines)
+			printf("%lu:%lu: ", (unsigned long) line,
+			       (unsigned long) (pos - line_start + 1));
+		if (*names[type - 1])
+			printf("%s: \"", names[type - 1]);
+		else
+			fputs("Error on finding type for: \"", stdout);
+		fwrite(source + pos, sizeof(char), len, stdout);
+		fputs("\"\n", stdout);
+		pos += len;
+	}
+
+	if (fflush(stdout))
+		err(1, "Error writing output");
+	free(names);
+	free(source);
+	free(tokens);
+	return 0;
+}
@@ -6,6 +6,20 @@
  * 	This program will take in multiple strings as a command line
  * 	argument. Then it will parse each piece and then return to
  * 	the user what type of argument was passed in.
+ * 	Alternatively, '-f <file>' streams the tokens out of a file
+ * 	(or stdin when the file is '-') a buffer at a time. Adding
+ * 	'-j <threads>' reads the whole file in and lexes pieces of it
+ * 	on that many threads at once. '-m <file>' works like '-f' but
+ * 	maps the file into memory and lexes it in place.
+ * 	'-o binary' writes the tokens out as the compact binary stream
+ * 	described in tokstream.h, which tokdecode turns back into text.
+ * 	'-o stats' only counts the tokens of each type and prints the
+ * 	totals at the end, '-o keywords' adds a histogram of the keywords.
+ * 	'-o symbols' prints words as symbol ids followed by the symbols.
+ * 	'-b <file | dir>...' tokenizes every file listed, and every file
+ * 	under each directory listed, on a pool of '-j' threads, writing the
+ * 	tokens out file by file in the same order every time.
+ * 	The lexing itself is done by the lexer library in lexer.c.
  *
  * 	For example,
  * 	./tokenizer hello array[123]
@@ -18,556 +32,1158 @@
  * 	Read README.PDF for more documentation.
  */
 
-#include <ctype.h>
+#include <dirent.h>
 #include <err.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
-#define ARRAY_SIZE(arr) ((int) (sizeof(arr)/sizeof(*(arr))))
+#include "lexer.h"
+#include "scan.h"
+#include "tokstream.h"
 
-/* Input Token struct to be used to make a linked list of tokens */
-struct input_token {
-	char *input;
-	struct input_token *next;
+/* Size of the buffers used to read files and collect output */
+#ifndef READ_BUFFER_SIZE
+#define READ_BUFFER_SIZE 65536
+#endif
+
+/* Number of tokens a token list starts out with room for */
+#define TOKEN_LIST_SIZE 256
+
+/* Size of the pieces a file is split into to be lexed in parallel */
+#ifndef PARALLEL_CHUNK_SIZE
+#define PARALLEL_CHUNK_SIZE (1 << 20)
+#endif
+
+/* How many lexed pieces or files per thread can wait to be written out */
+#define PENDING_CHUNKS 4
+
+/* Width of the longest bar in the keyword histogram */
+#define HISTOGRAM_WIDTH 50
+
+/* Formats tokens can be output in, picked with '-o' */
+enum output_format {
+	OUTPUT_TEXT,
+	OUTPUT_BINARY,
+	OUTPUT_SYMBOLS,		/* Words as symbol ids, then the symbol table */
+	OUTPUT_STATS,		/* Only count the tokens of each type */
+	OUTPUT_KEYWORDS		/* Counts plus a histogram of the keywords */
 };
 
-/* C Token struct to be used to make arrays of C keywords and symbols */
-struct C_token {
-	const char *name;
-	const char *operator;
+/* Token list struct. One contiguous array of tokens that grows as needed */
+struct token_list {
+	struct token *tokens;
+	int count;
+	int capacity;
+};
+
+/* Path list struct. The files to tokenize in batch mode, in order */
+struct path_list {
+	char **paths;
+	int count;
+	int capacity;
 };
 
-void free_list(struct input_token *);
-void parse_tokens(struct input_token *);
-void print_token(const char *type, const char *tok);
-void sanitize_num(struct input_token **);
-void sanitize_symbol(struct input_token **);
-void sanitize_tokens(struct input_token **);
-void sanitize_word(struct input_token **);
-void split_token(struct input_token **, int);
-void strcopy(const char *src, char *dest, int n);
-int is_float (const char *str);
-int is_hex(const char *str);
-int is_octal(const char *str);
-int num_of_tokens(char *arg);
-struct input_token *new_token_node(int);
-struct input_token *create_token_list(char *arg);
+/*
+ * Growable buffer that formatted tokens are collected in before writing.
+ * For binary output, pos is how far into the input the records in it (and
+ * every record written before them) reach, and line is the line the last
+ * of them is on. When only counting tokens, the counts of each type go in
+ * counts instead.
+ */
+struct output_buffer {
+	char *data;
+	size_t len;
+	size_t size;
+	size_t pos;
+	unsigned int line;
+	unsigned long counts[NUM_TOKEN_TYPES];
+};
+
+/*
+ * Chunk struct. One piece of a file being lexed in parallel, along with
+ * the output formatted for it once a worker thread has lexed it.
+ */
+struct chunk {
+	size_t start;
+	size_t end;
+	struct output_buffer out;
+	struct token_list tokens;
+	int done;
+};
 
 /*
- * Array to keep track of all operators used in the C language.
- * Used mainly to parse symbols given by user input.
+ * Parallel job struct. Shared by the worker threads, which take chunks in
+ * order, and the main thread, which writes chunks out in that same order.
+ * Workers stop taking chunks while too many are waiting to be written.
  */
-const struct C_token C_tokens[] = {
-	{"left parenthesis", "("},
-	{"right parenthesis", ")"},
-	{"left brace", "["},
-	{"right brace", "]"},
-	{"structure member", "."},
-	{"structure pointer", "->"},
-	{"comma", ","},
-	{"negate", "!"},
-	{"1s complement", "~"},
-	{"shift right", ">>"},
-	{"shift left", "<<"},
-	{"bitwise XOR", "^"},
-	{"bitwise OR", "|"},
-	{"increment", "++"},
-	{"decrement", "--"},
-	{"addition", "+"},
-	{"division", "/"},
-	{"modulo", "%"},
-	{"logical OR", "||"},
-	{"logical AND", "&&"},
-	{"conditional true", "?"},
-	{"conditional false", ":"},
-	{"equality test", "=="},
-	{"inequality test", "!="},
-	{"less than test", "<"},
-	{"greater than test", ">"},
-	{"less than or equal test", "<="},
-	{"greater than or equal test", ">="},
-	{"assignment", "="},
-	{"plus equals", "+="},
-	{"minus equals", "-="},
-	{"times equals", "*="},
-	{"divide equals", "/="},
-	{"mod equals", "%="},
-	{"shift right equals", ">>="},
-	{"shift left equals", "<<="},
-	{"bitwise AND equals", "&="},
-	{"bitwise XOR equals", "^="},
-	{"bitwise OR equals", "|="},
-	{"AND/address operator", "&"},
-	{"minus/subtract operator", "-"},
-	{"multiply/dereference operator", "*"},
+struct parallel_job {
+	char *data;
+	struct chunk *chunks;
+	int num_chunks;
+	int next_chunk;
+	int written;
+	int max_pending;
+	pthread_mutex_t mut;
+	pthread_cond_t cond;
 };
 
 /*
- * Array to keep track of all keywords used in the C language.
- * Used mainly to parse words given by user input to determine
- * if they are a keyword or not.
+ * Batch slot struct. Output for one file in batch mode. File i goes in slot
+ * i % max_pending, which is free again once file i has been written out.
+ * The file is read into the slot's own buffer, which is reused for every
+ * file that goes in the slot.
  */
-const struct C_token C_keywords[] = {
-	{"if keyword", "if"},
-	{"else keyword", "else"},
-	{"do keyword", "do"},
-	{"while keyword", "while"},
-	{"for keyword", "for"},
-	{"char keyword", "char"},
-	{"int keyword", "int"},
-	{"double keyword", "double"},
-	{"float keyword", "float"},
-	{"long keyword", "long"},
-	{"short keyword", "short"},
-	{"return keyword", "return"},
-	{"break keyword", "break"},
-	{"continue keyword", "continue"},
-	{"const keyword", "const"},
-	{"struct keyword", "struct"},
-	{"unsigned keyword", "unsigned"},
-	{"signed keyword", "signed"},
-	{"switch keyword", "switch"},
-	{"void keyword", "void"},
-	{"case keyword", "case"},
-	{"default keyword", "default"},
-	{"register keyword", "register"},
-	{"typedef keyword", "typedef"},
-	{"enum keyword", "enum"},
-	{"goto keyword", "goto"},
-	{"static keyword", "static"},
-	{"union keyword", "union"},
-	{"volatile keyword", "volatile"},
-	{"extern keyword", "extern"},
-	{"sizeof keyword", "sizeof"},
+struct batch_slot {
+	struct output_buffer out;
+	struct token_list tokens;
+	char *data;
+	size_t size;
+	int done;
+	int failed;
 };
 
 /*
- * Copies n characters from src to dest.
- * At n + 1 characters places a null byte.
+ * Batch job struct. Shared by the worker threads, which take files in
+ * order, and the main thread, which writes each file's output in that same
+ * order. Workers stop taking files while every slot is waiting to be
+ * written, so only max_pending output buffers are ever around.
  */
-void strcopy(const char *src, char *dest, int n)
+struct batch_job {
+	const struct path_list *files;
+	struct batch_slot *slots;
+	int next_file;
+	int written;
+	int max_pending;
+	pthread_mutex_t mut;
+	pthread_cond_t cond;
+};
+
+void add_chunk(struct chunk **, int *, int *, size_t, size_t);
+void add_path(struct path_list *, char *path);
+void create_token_list(struct lexer *, struct token_list *);
+void free_list(struct token_list *);
+void free_paths(struct path_list *);
+void output_token(struct output_buffer *, const struct token *);
+void print_stats(void);
+void print_symbols(void);
+void print_token(struct output_buffer *, const char *type, const char *tok, int len);
+void print_tokens(struct output_buffer *, const struct token_list *);
+void put_header(struct output_buffer *);
+void put_output(struct output_buffer *, const char *str, size_t len);
+void put_position(struct output_buffer *, unsigned int line, unsigned int column);
+void put_record(struct output_buffer *, const struct token *);
+void put_skip(struct output_buffer *, size_t offset, unsigned int line, unsigned int column);
+void put_varint(struct output_buffer *, size_t);
+void tokenize_mapped(char *, size_t);
+void tokenize_parallel(char *, size_t, int);
+void tokenize_stream(FILE *);
+void write_output(struct output_buffer *);
+void *start_batch_worker(void *);
+void *start_worker(void *);
+char *join_path(const char *dir, const char *name);
+char *map_file(const char *, size_t *);
+char *read_file(FILE *, size_t *);
+int compare_paths(const void *, const void *);
+int find_chunks(const char *data, size_t len, struct chunk **);
+int find_files(struct path_list *, const char *path);
+int load_file(const char *path, char **buf, size_t *size, size_t *len);
+int lex_to_output(struct lexer *, struct output_buffer *, int);
+int tokenize_batch(const struct path_list *, int);
+int tokenize_buffer(struct lexer *, struct token_list *, struct output_buffer *);
+int walk_directory(struct path_list *, const char *dir);
+struct token *new_token(struct token_list *);
+
+/* Output format picked with '-o', and what each one is called there */
+int output_format = OUTPUT_TEXT;
+const char *output_formats[] = {"text", "binary", "symbols", "stats", "keywords"};
+
+/* Counts of each type of token written out so far, for '-o stats' */
+unsigned long token_counts[NUM_TOKEN_TYPES];
+
+/* Every word written out so far, for '-o symbols' */
+struct symbol_table symbols;
+
+/* Appends len bytes of str to the output buffer, growing it if needed */
+void put_output(struct output_buffer *out, const char *str, size_t len)
 {
-	while (n--)
-		*dest++ = *src++;
-	*dest = '\0';
+	char *save;
+
+	if (out->len + len > out->size) {
+		do {
+			out->size = out->size ? out->size * 2 : READ_BUFFER_SIZE;
+		} while (out->len + len > out->size);
+		save = realloc(out->data, sizeof(char) * out->size);
+		if (!save)
+			err(-1, "Error allocating memory.");
+		out->data = save;
+	}
+	memcpy(out->data + out->len, str, len);
+	out->len += len;
 }
 
 /*
- * Takes in a string (str) and parses it for a decimal.
- * Returns 1 if decimal found, 0 if none.
+ * Writes everything in the output buffer to stdout and empties it. Token
+ * counts in it are added to the totals and emptied out the same way.
  */
-int is_float(const char *str)
+void write_output(struct output_buffer *out)
+{
+	int type;
+
+	if (output_format >= OUTPUT_STATS) {
+		for (type = 0; type < NUM_TOKEN_TYPES; type++) {
+			token_counts[type] += out->counts[type];
+			out->counts[type] = 0;
+		}
+	}
+	if (out->len && fwrite(out->data, sizeof(char), out->len, stdout) != out->len)
+		err(1, "Error writing output");
+	out->len = 0;
+}
+
+/* Formats token type and the token for the user into the output buffer */
+void print_token(struct output_buffer *out, const char *type, const char *token, int len)
 {
-	while (*str) {
-		if (*str == '.' && str[1] != '\0')
-			return 1;
-		str++;
+	if (type) {
+		put_output(out, type, strlen(type));
+		put_output(out, ": \"", 3);
+	} else {
+		put_output(out, "Error on finding type for: \"", 28);
 	}
-	return 0;
+	put_output(out, token, len);
+	put_output(out, "\"\n", 2);
+}
+
+/* Appends v to the output buffer as a varint */
+void put_varint(struct output_buffer *out, size_t v)
+{
+	char buf[VARINT_MAX_LEN];
+	size_t len = 0;
+
+	while (v >= 0x80) {
+		buf[len++] = (char) (v | 0x80);
+		v >>= 7;
+	}
+	buf[len++] = (char) v;
+	put_output(out, buf, len);
 }
 
 /*
- * Takes in a string (str) and parses to make sure all characters are
- * numbers and that they are all in the range of 0-7.
+ * Appends how many lines a record is past the last one, followed by its
+ * column only when it is on a new line, since the column on the same line
+ * follows from the offset.
  */
-int is_octal(const char *str)
+void put_position(struct output_buffer *out, unsigned int line, unsigned int column)
+{
+	put_varint(out, line - out->line);
+	if (line != out->line)
+		put_varint(out, column);
+	out->line = line;
+}
+
+/* Appends a binary record for a token */
+void put_record(struct output_buffer *out, const struct token *tok)
+{
+	put_varint(out, tok->type + 1);
+	put_varint(out, tok->offset - out->pos);
+	put_varint(out, tok->length);
+	put_position(out, tok->line, tok->column);
+	out->pos = tok->offset + tok->length;
+}
+
+/* Appends a binary record that moves the position up to offset */
+void put_skip(struct output_buffer *out, size_t offset, unsigned int line, unsigned int column)
+{
+	put_varint(out, TOKSTREAM_SKIP);
+	put_varint(out, offset - out->pos);
+	put_position(out, line, column);
+	out->pos = offset;
+}
+
+/* Appends the binary stream header, which names every token type */
+void put_header(struct output_buffer *out)
 {
-	if (*str == '0' && str[1] != '\0') {
-		while (*++str) {
-			if (*str < '0' || *str > '7')
-				return 0;
+	const char version = TOKSTREAM_VERSION;
+	const char *name;
+	int type;
+
+	put_output(out, TOKSTREAM_MAGIC, TOKSTREAM_MAGIC_LEN);
+	put_output(out, &version, 1);
+	put_varint(out, NUM_TOKEN_TYPES);
+	for (type = 0; type < NUM_TOKEN_TYPES; type++) {
+		name = token_name(type);
+		if (!name)
+			name = "";
+		put_output(out, name, strlen(name) + 1);
+	}
+}
+
+/*
+ * Puts one token into the output buffer in whichever format was asked for.
+ * For '-o symbols' words are interned here, so this has to be called on
+ * one thread only, in the order the tokens are written out.
+ */
+void output_token(struct output_buffer *out, const struct token *tok)
+{
+	char buf[32];
+	unsigned int id;
+
+	switch (output_format) {
+	case OUTPUT_TEXT:
+		print_token(out, token_name(tok->type), tok->text, tok->length);
+		break;
+	case OUTPUT_SYMBOLS:
+		if (tok->type != TOK_WORD) {
+			print_token(out, token_name(tok->type), tok->text, tok->length);
+			break;
 		}
-		return 1;
+		if (symtab_intern(&symbols, tok->text, tok->length, &id) < 0)
+			err(-1, "Error allocating memory.");
+		put_output(out, buf, sprintf(buf, "word: %u\n", id));
+		break;
+	case OUTPUT_BINARY:
+		put_record(out, tok);
+		break;
+	default:
+		out->counts[tok->type]++;
+		break;
 	}
-	return 0;
 }
 
 /*
- * Takes in a string (str) and parses to make sure all characters are
- * numbers and or letters that are all in the hex character range (0-9, a - f)
+ * Prints how many tokens of each type were found, with every keyword
+ * counted as one "keyword" line. For '-o keywords' a histogram of each
+ * keyword follows, scaled so the most common one gets the longest bar.
  */
-int is_hex(const char *str)
+void print_stats(void)
 {
-	char curr_char;
+	unsigned long total = 0, keywords = 0, most = 0;
+	const char *name;
+	int type, bar;
 
-	if (str[0] == '0' && (str[1] == 'x' || str[1] == 'X')) {
-		str += 2;
-		while ((curr_char = *str++)) {
-			if (!isxdigit(curr_char))
-				return 0;
+	printf("Token counts:\n");
+	for (type = 0; type < NUM_TOKEN_TYPES; type++) {
+		total += token_counts[type];
+		if (type >= TOK_KEYWORD) {
+			keywords += token_counts[type];
+			if (token_counts[type] > most)
+				most = token_counts[type];
+		} else if (token_counts[type]) {
+			name = token_name(type);
+			printf("%s: %lu\n", name ? name : "unknown", token_counts[type]);
 		}
-		return 1;
 	}
-	return 0;
+	if (keywords)
+		printf("keyword: %lu\n", keywords);
+	printf("total: %lu\n", total);
+
+	if (output_format != OUTPUT_KEYWORDS || !keywords)
+		return;
+	printf("\nKeywords:\n");
+	for (type = TOK_KEYWORD; type < NUM_TOKEN_TYPES; type++) {
+		if (!token_counts[type])
+			continue;
+		printf("%-20s %10lu ", token_name(type), token_counts[type]);
+		for (bar = token_counts[type] * HISTOGRAM_WIDTH / most; bar > 0; bar--)
+			putchar('#');
+		putchar('\n');
+	}
+}
+
+/* Prints every interned word after its symbol id, in order of id */
+void print_symbols(void)
+{
+	size_t id;
+
+	printf("Symbols:\n");
+	for (id = 0; id < symbols.count; id++)
+		printf("%lu: \"%s\"\n", (unsigned long) id, symbols.symbols[id].name);
 }
 
-/* Prints token type and the token to the user */
-void print_token(const char *type, const char *token)
+/* Formats every token in the token list into the output buffer */
+void print_tokens(struct output_buffer *out, const struct token_list *list)
 {
-	if (type)
-		printf("%s: \"%s\"\n", type, token);
-	else
-		printf("Error on finding type for: \"%s\"\n", token);
+	const struct token *tok;
+
+	for (tok = list->tokens; tok < list->tokens + list->count; tok++)
+		output_token(out, tok);
 }
 
 /*
- * Takes in an integer representing how long the token node's string
- * is. Then mallocs the appropriate space to hold the node and its token.
+ * Makes room for one more token at the end of the token list, growing
+ * the list if it is full. Returns a pointer to the new token.
  */
-struct input_token *new_token_node(int toklen)
+struct token *new_token(struct token_list *list)
 {
-	struct input_token *new;
+	struct token *save;
 
-	new = malloc(sizeof(*new));
-	if (!new)
-		err(-1, "Error allocating memory.");
-	new->input = malloc(sizeof(char) * (toklen + 1));
-	if (!new->input)
-		err(-1, "Error allocating memory.");
-	new->next = NULL;
-	return new;
+	if (list->count == list->capacity) {
+		list->capacity = list->capacity ? list->capacity * 2 : TOKEN_LIST_SIZE;
+		save = realloc(list->tokens, sizeof(*save) * list->capacity);
+		if (!save)
+			err(-1, "Error allocating memory.");
+		list->tokens = save;
+	}
+	return &list->tokens[list->count++];
+}
+
+/* Frees up memory being used by the token list */
+void free_list(struct token_list *list)
+{
+	free(list->tokens);
+	list->tokens = NULL;
+	list->count = list->capacity = 0;
+}
+
+/*
+ * Takes in a lexer and pulls every token left out of it, adding them all
+ * to the token list.
+ */
+void create_token_list(struct lexer *lex, struct token_list *list)
+{
+	struct token tok;
+	int found;
+
+	while ((found = lexer_next(lex, &tok)) > 0)
+		*new_token(list) = tok;
+	if (found < 0)
+		err(1, "Error reading input");
 }
 
-/* Frees up memory being used by input token list */
-void free_list(struct input_token *list)
+/*
+ * Pulls every token left out of the lexer straight into the output buffer,
+ * without keeping a token list around. If flush is set the output is
+ * written out every time the output buffer fills up.
+ * Returns the number of tokens found.
+ */
+int lex_to_output(struct lexer *lex, struct output_buffer *out, int flush)
 {
-	struct input_token *temp;
-	while (list) {
-		temp = list;
-		list = list->next;
-		free(temp->input);
-		free(temp);
+	struct token tok;
+	int found, count = 0;
+
+	while ((found = lexer_next(lex, &tok)) > 0) {
+		output_token(out, &tok);
+		count++;
+		if (flush && out->len >= READ_BUFFER_SIZE)
+			write_output(out);
 	}
+	if (found < 0)
+		err(1, "Error reading input");
+	if (flush)
+		write_output(out);
+	return count;
 }
 
 /*
- * Takes in a pointer to a string of tokens and breaks them up by
- * returning pointers to null terminated strings of each token.
+ * Runs a lexer's input through all the tokenizing steps. The token list
+ * is emptied out first so its memory can be reused.
+ * Returns 0 if no tokens were found, non-zero otherwise.
  */
-struct input_token *create_token_list(char *arg)
+int tokenize_buffer(struct lexer *lex, struct token_list *list,
+		    struct output_buffer *out)
 {
-	struct input_token *head = NULL, **list_walker = NULL;
-	int toklen;
-	char *start_of_token, *parser = arg;
+	list->count = 0;
 
-	list_walker = &head;
-	while (1) {
-		/* Skip all white space */
-		while (isspace(*parser))
-			parser++;
+	/* Create token List */
+	create_token_list(lex, list);
 
-		if (*parser == '\0')
-			break;
+	/* Print the typed tokens */
+	print_tokens(out, list);
+	write_output(out);
+	return list->count;
+}
+
+/*
+ * Tokenizes a file one buffer at a time. Tokens and comments that get cut
+ * off at the end of a buffer are picked back up by the lexer after it
+ * reads in more, and tokens are printed as soon as they are found.
+ */
+void tokenize_stream(FILE *fp)
+{
+	struct lexer lex;
+	struct output_buffer out = {0};
 
-		/* Track the beginning of the token and it's length */
-		start_of_token = parser;
-		toklen = 0;
+	lexer_init_file(&lex, fp);
+	lex_to_output(&lex, &out, 1);
+	lexer_finish(&lex);
+	free(out.data);
+}
+
+/*
+ * Reads all of a file into memory, since lexing it in parallel needs all
+ * of it at once. Returns the contents, len is set to their length.
+ */
+char *read_file(FILE *fp, size_t *len)
+{
+	char *data = NULL, *save;
+	size_t size = 0, nr;
+
+	*len = 0;
+	do {
+		if (*len == size) {
+			size = size ? size * 2 : READ_BUFFER_SIZE;
+			save = realloc(data, sizeof(char) * size);
+			if (!save)
+				err(-1, "Error allocating memory.");
+			data = save;
+		}
+		nr = fread(data + *len, sizeof(char), size - *len, fp);
+		*len += nr;
+	} while (nr);
+
+	if (ferror(fp))
+		err(1, "Error reading input");
+	return data;
+}
+
+/* Adds a chunk covering start to end to the end of an array of chunks */
+void add_chunk(struct chunk **chunks, int *num_chunks, int *size, size_t start, size_t end)
+{
+	struct chunk *save;
+
+	if (*num_chunks == *size) {
+		*size = *size ? *size * 2 : 16;
+		save = realloc(*chunks, sizeof(*save) * *size);
+		if (!save)
+			err(-1, "Error allocating memory.");
+		*chunks = save;
+	}
+	(*chunks)[*num_chunks].start = start;
+	(*chunks)[*num_chunks].end = end;
+	(*chunks)[*num_chunks].done = 0;
+	memset(&(*chunks)[*num_chunks].out, 0, sizeof((*chunks)[*num_chunks].out));
+	memset(&(*chunks)[*num_chunks].tokens, 0, sizeof((*chunks)[*num_chunks].tokens));
+	(*num_chunks)++;
+}
+
+/*
+ * Splits data up into chunks of about PARALLEL_CHUNK_SIZE bytes that can
+ * be lexed on their own. A chunk only ever ends right after a newline that
+ * is not inside a block comment, where the lexer is always back in START.
+ * Finding those takes a quick pre-scan that only looks at comments and
+ * at string and character literals, which can hide what looks like one,
+ * using find_any() to jump from one '/', '"' or '\'' to the next.
+ * Returns the number of chunks, which are put in a new array in chunks.
+ */
+int find_chunks(const char *data, size_t len, struct chunk **chunks)
+{
+	size_t pos = 0, next, nl, split = PARALLEL_CHUNK_SIZE, chunk_start = 0;
+	int num_chunks = 0, size = 0, in_block_comment = 0, quote = 0;
+
+	*chunks = NULL;
+	while (pos < len) {
+		if (in_block_comment) {
+			pos = find_byte(data, pos, len, '*');
+			if (pos + 1 < len && data[pos + 1] == '/') {
+				in_block_comment = 0;
+				pos++;
+			}
+			pos++;
+			continue;
+		}
 
 		/*
-		 * Parse through the characters, if we come across comment
-		 * sequence '//' or '/ *' then skip ahead
+		 * Literals end at their closing quote or at the end of the line,
+		 * a backslash takes the byte after it along unless it is the
+		 * newline.
 		 */
-		while (!isspace(*parser) && *parser != '\0') {
-			if (*parser == '/' && parser[1] == '/') {
-				while (*parser != '\n' && *parser != '\0') {
-					parser ++;
-				}
-				break;
-			} else if (*parser == '/' && parser[1] == '*') {
-				parser += 2;
-				while (*parser != '\0') {
-					if (*parser == '*' && parser[1] == '/') {
-						parser += 2;
-						break;
-					}
-					parser++;
-				}
-				break;
+		if (quote) {
+			pos = find_any(data, pos, len, quote, '\\', '\n');
+			if (pos + 1 < len && data[pos] == '\\' && data[pos + 1] != '\n') {
+				pos += 2;
 			} else {
-				parser++;
-				toklen++;
+				if (pos < len && data[pos] != '\n')
+					pos++;
+				quote = 0;
 			}
+			continue;
 		}
 
+		/* Split at the first newline past the split point before a comment */
+		next = find_any(data, pos, len, '/', '"', '\'');
+		if (next >= split) {
+			nl = find_byte(data, pos > split ? pos : split, next, '\n');
+			if (nl < next) {
+				add_chunk(chunks, &num_chunks, &size, chunk_start, nl + 1);
+				chunk_start = pos = nl + 1;
+				split = pos + PARALLEL_CHUNK_SIZE;
+				continue;
+			}
+		}
+		if (next >= len)
+			break;
+
+		if (data[next] != '/') {
+			quote = data[next];
+			pos = next + 1;
+		} else if (next + 1 >= len) {
+			break;
+		} else if (data[next + 1] == '/') {
+			pos = find_byte(data, next + 2, len, '\n');
+		} else if (data[next + 1] == '*') {
+			in_block_comment = 1;
+			pos = next + 2;
+		} else {
+			pos = next + 1;
+		}
+	}
+
+	/* Whatever is left over is the last chunk */
+	add_chunk(chunks, &num_chunks, &size, chunk_start, len);
+	return num_chunks;
+}
+
+/*
+ * Worker thread kickoff. Keeps taking the next chunk that still needs to
+ * be lexed, and formats its tokens into the chunk's own output buffer.
+ * Symbol ids depend on every word before them, so for '-o symbols' the
+ * tokens are only listed here and formatted once the chunk is written.
+ * Return Value: NULL.
+ */
+void *start_worker(void *data)
+{
+	struct parallel_job *job = data;
+	struct lexer lex;
+	struct chunk *chunk;
+
+	pthread_mutex_lock(&job->mut);
+	while (1) {
+		while (job->next_chunk < job->num_chunks &&
+		       job->next_chunk >= job->written + job->max_pending)
+			pthread_cond_wait(&job->cond, &job->mut);
+		if (job->next_chunk == job->num_chunks)
+			break;
+		chunk = &job->chunks[job->next_chunk++];
+		pthread_mutex_unlock(&job->mut);
+
 		/*
-		 * Allocate space and then copy the token to be used later
-		 * only if we counted > 0 characters.
+		 * Chunks are lexed in place, with token offsets into the file.
+		 * How many lines come before a chunk is not known until the
+		 * chunks before it are lexed, but binary records only hold how
+		 * many lines they are past the last one, so lines are counted
+		 * from the start of the chunk. The stream itself starts out
+		 * before the first line, so the first chunk starts on line 0.
 		 */
-		if (toklen > 0) {
-			*list_walker = new_token_node(toklen);
-			strcopy(start_of_token, (*list_walker)->input, toklen);
-			list_walker = &(*list_walker)->next;
-		}
+		lexer_init(&lex, job->data + chunk->start, chunk->end - chunk->start);
+		lex.base = chunk->start;
+		lex.line_start = chunk->start;
+		chunk->out.pos = chunk->start;
+		chunk->out.line = chunk->start ? lex.line : 0;
+		if (output_format == OUTPUT_SYMBOLS)
+			create_token_list(&lex, &chunk->tokens);
+		else
+			lex_to_output(&lex, &chunk->out, 0);
+
+		/* Binary records carry on from wherever the last chunk ends */
+		if (output_format == OUTPUT_BINARY && chunk->out.pos < chunk->end)
+			put_skip(&chunk->out, chunk->end, lex.line,
+				 chunk->end - lex.line_start + 1);
+
+		pthread_mutex_lock(&job->mut);
+		chunk->done = 1;
+		pthread_cond_broadcast(&job->cond);
 	}
-	return head;
+	pthread_mutex_unlock(&job->mut);
+	return NULL;
 }
 
 /*
- * Takes in a pointer to an input token list and goes throught the list.
- * At every point in the list it checks what type of token it is and then
- * prints that type and token to the user. This is called after all tokens
- * have been read from command line AND have been sanitized.
+ * Tokenizes a whole file held in memory on num_threads worker threads. The
+ * file is split into chunks, and while the workers lex them the main thread
+ * writes each chunk's output as soon as it and every chunk before it are
+ * done, so the output is exactly what tokenizing the file in one go gives.
  */
-void parse_tokens(struct input_token *list)
+void tokenize_parallel(char *data, size_t len, int num_threads)
 {
-	const char *token, *token_type;
+	struct parallel_job job;
+	pthread_t *pool;
 	int i;
 
-	while (list) {
-		token = list->input;
-		token_type = NULL;
-
-		/* If it starts with a letter its prob a word */
-		if (isalpha(*token)) {
-			token_type = "word";
-			/* Scan to see if it is a special C keyword */
-			for (i = 0; i < ARRAY_SIZE(C_keywords); i++){
-				if (!strcmp(token, C_keywords[i].operator)) {
-					token_type = C_keywords[i].name;
-					break;
-				}
-			}
-		/* If the starting char is a number it has to be a number */
-		} else if (isdigit(*token)) {
-			if (is_hex(token)) {
-				token_type = "hex integer";
-			} else if (is_octal(token)) {
-				token_type = "octal integer";
-			} else if (is_float(token)) {
-				token_type = "float";
-			} else {
-				token_type = "decimal integer";
-			}
-		/* If it is neither a number nor letter then it must be a symbol */
-		} else {
-			for (i = 0; i < ARRAY_SIZE(C_tokens); i++) {
-				if (!strcmp(token, C_tokens[i].operator)) {
-					token_type = C_tokens[i].name;
-					break;
-				}
-			}
-		}
-		print_token(token_type, token);
-		list = list->next;
+	job.data = data;
+	job.num_chunks = find_chunks(data, len, &job.chunks);
+	job.next_chunk = 0;
+	job.written = 0;
+	job.max_pending = num_threads * PENDING_CHUNKS;
+	pthread_mutex_init(&job.mut, NULL);
+	pthread_cond_init(&job.cond, NULL);
+
+	if (!(pool = malloc(sizeof(*pool) * num_threads)))
+		err(-1, "Error allocating memory.");
+	for (i = 0; i < num_threads; i++) {
+		if (pthread_create(&pool[i], NULL, start_worker, &job))
+			errx(1, "Error creating worker thread.");
+	}
+
+	for (i = 0; i < job.num_chunks; i++) {
+		pthread_mutex_lock(&job.mut);
+		while (!job.chunks[i].done)
+			pthread_cond_wait(&job.cond, &job.mut);
+		pthread_mutex_unlock(&job.mut);
+
+		print_tokens(&job.chunks[i].out, &job.chunks[i].tokens);
+		free_list(&job.chunks[i].tokens);
+		write_output(&job.chunks[i].out);
+		free(job.chunks[i].out.data);
+
+		pthread_mutex_lock(&job.mut);
+		job.written++;
+		pthread_cond_broadcast(&job.cond);
+		pthread_mutex_unlock(&job.mut);
 	}
+
+	for (i = 0; i < num_threads; i++)
+		pthread_join(pool[i], NULL);
+	pthread_mutex_destroy(&job.mut);
+	pthread_cond_destroy(&job.cond);
+	free(pool);
+	free(job.chunks);
 }
 
 /*
- * Splits a input token into two seperate token nodes.
- * Where the input string is split is determined by toklen.
- * This function is mainly going to be called for sanitizing
- * input tokens that have multiple tokens attached together
- * such as array[123] or 123abc.
- * Ex: OriginalNode -> "123abc"
- *     |
- *     |- node1 -> "123"
- *     |- node2 -> "abc"
+ * Maps a file into memory so it can be lexed in place, without reading
+ * any of it into buffers of our own. The kernel is told we will go through
+ * it front to back so it can read ahead and drop pages we are done with.
+ * Returns the mapping (NULL for an empty file), len is set to its length.
  */
-void split_token(struct input_token **token_node, int toklen)
+char *map_file(const char *path, size_t *len)
 {
-	struct input_token *node1, *node2;
-	char *token_to_split = (*token_node)->input;
-	int remaining_length;
+	struct stat st;
+	char *data = NULL;
+	int fd;
 
-	remaining_length = strlen(token_to_split) - toklen;
+	if ((fd = open(path, O_RDONLY)) < 0)
+		err(1, "Cannot open '%s'", path);
+	if (fstat(fd, &st) < 0)
+		err(1, "Cannot stat '%s'", path);
+	if (!S_ISREG(st.st_mode))
+		errx(1, "'%s' is not a regular file, it can not be mapped.", path);
 
-	node1 = new_token_node(toklen);
-	node2 = new_token_node(remaining_length);
+	*len = st.st_size;
+	if (*len) {
+		data = mmap(NULL, *len, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data == MAP_FAILED)
+			err(1, "Cannot map '%s'", path);
+		if (madvise(data, *len, MADV_SEQUENTIAL) < 0)
+			warn("madvise failed on '%s'", path);
+	}
+	close(fd);
+	return data;
+}
 
-	strcopy(token_to_split, node1->input, toklen);
-	node1->next = node2;
-	strcopy((token_to_split + toklen), node2->input, remaining_length);
-	node2->next = (*token_node)->next;
+/* Tokenizes a mapped file in one pass, printing tokens as they are found */
+void tokenize_mapped(char *data, size_t len)
+{
+	struct lexer lex;
+	struct output_buffer out = {0};
 
-	/* Free the old node and it's token we don't need anymore */
-	free(token_to_split);
-	free(*token_node);
-	*token_node = node1;
+	lexer_init(&lex, data, len);
+	lex_to_output(&lex, &out, 1);
+	free(out.data);
+}
+
+/* Adds a path to the end of the path list, which takes ownership of it */
+void add_path(struct path_list *files, char *path)
+{
+	char **save;
+
+	if (files->count == files->capacity) {
+		files->capacity = files->capacity ? files->capacity * 2 : TOKEN_LIST_SIZE;
+		save = realloc(files->paths, sizeof(*save) * files->capacity);
+		if (!save)
+			err(-1, "Error allocating memory.");
+		files->paths = save;
+	}
+	files->paths[files->count++] = path;
+}
+
+/* Frees up every path in the path list and the list itself */
+void free_paths(struct path_list *files)
+{
+	int i;
+
+	for (i = 0; i < files->count; i++)
+		free(files->paths[i]);
+	free(files->paths);
+	files->paths = NULL;
+	files->count = files->capacity = 0;
+}
+
+/* Orders paths by name, for qsort() */
+int compare_paths(const void *a, const void *b)
+{
+	const char *const *path_a = a, *const *path_b = b;
+
+	return strcmp(*path_a, *path_b);
+}
+
+/* Returns a new string with the path to name inside of dir */
+char *join_path(const char *dir, const char *name)
+{
+	size_t dir_len = strlen(dir), name_len = strlen(name);
+	char *path;
+
+	if (dir_len && dir[dir_len - 1] == '/')
+		dir_len--;
+	if (!(path = malloc(dir_len + name_len + 2)))
+		err(-1, "Error allocating memory.");
+	memcpy(path, dir, dir_len);
+	path[dir_len] = '/';
+	memcpy(path + dir_len + 1, name, name_len + 1);
+	return path;
 }
 
 /*
- * Sanitizes strings starting with a letter. Splits token
- * in two if it runs into a character that is NOT alphanumeric.
+ * Adds every regular file under a directory to the path list. The files
+ * in each directory come first, sorted by name, followed by each of its
+ * subdirectories in order, so a tree always comes out in the same order.
+ * The type readdir() gives is used when there is one, to save stat()ing
+ * every file, and symbolic links are skipped so a link can never loop.
+ * Returns the number of directories that could not be read.
  */
-void sanitize_word(struct input_token **token_node)
+int walk_directory(struct path_list *files, const char *dir)
 {
-	char *parser = (*token_node)->input;
-	int toklen = 0;
+	struct path_list subdirs = {0};
+	struct dirent *ent;
+	struct stat st;
+	DIR *dp;
+	char *path;
+	int i, first = files->count, failed = 0;
+	unsigned char type;
 
-	while (*parser) {
-		if (!isalnum(*parser)) {
-			split_token(token_node, toklen);
-			break;
-		}
-		toklen++;
-		parser++;
+	if (!(dp = opendir(dir))) {
+		warn("Cannot open '%s'", dir);
+		return 1;
+	}
+	while ((ent = readdir(dp))) {
+		if (!strcmp(ent->d_name, ".") || !strcmp(ent->d_name, ".."))
+			continue;
+		path = join_path(dir, ent->d_name);
+		type = ent->d_type;
+		if (type == DT_UNKNOWN && !lstat(path, &st))
+			type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : DT_LNK;
+
+		if (type == DT_REG)
+			add_path(files, path);
+		else if (type == DT_DIR)
+			add_path(&subdirs, path);
+		else
+			free(path);
 	}
+	closedir(dp);
+
+	if (files->count > first)
+		qsort(files->paths + first, files->count - first, sizeof(*files->paths), compare_paths);
+	if (subdirs.count)
+		qsort(subdirs.paths, subdirs.count, sizeof(*subdirs.paths), compare_paths);
+	for (i = 0; i < subdirs.count; i++)
+		failed += walk_directory(files, subdirs.paths[i]);
+	free_paths(&subdirs);
+	return failed;
 }
 
 /*
- * Takes in a pointer to a pointer to an input node that holds a
- * string starting with a number. Sanitize it such that it has no
- * symbols or letters within it.
+ * Adds a path given on the command line to the path list, or everything
+ * under it if it is a directory.
+ * Returns the number of paths that could not be looked at.
  */
-void sanitize_num(struct input_token **token_node)
-{
-	char *parser = (*token_node)->input;
-	int toklen = 0, hex_num = 0, float_num = 0;
-	if (*parser == '0' && (parser[1] == 'x' || parser[1] == 'X')) {
-		hex_num = 1;
-		parser += 2;
-		toklen += 2;
+int find_files(struct path_list *files, const char *path)
+{
+	struct stat st;
+	char *copy;
+
+	if (stat(path, &st) < 0) {
+		warn("Cannot open '%s'", path);
+		return 1;
 	}
+	if (S_ISDIR(st.st_mode))
+		return walk_directory(files, path);
+	if (!(copy = strdup(path)))
+		err(-1, "Error allocating memory.");
+	add_path(files, copy);
+	return 0;
+}
 
-	while (*parser) {
-		if ((isalpha(*parser) && !hex_num) || (isalpha(*parser) && !isxdigit(*parser))) {
-			if (float_num == 1 && *parser == 'e') {
-				parser++;
-				toklen++;
-			} else {
-				split_token(token_node, toklen);
-				break;
-			}
-		} else if (ispunct(*parser)) {
-			if (*parser == '.' && !hex_num) {
-				float_num = 1;
-			} else {
-				split_token(token_node, toklen);
-				break;
-			}
+/*
+ * Reads all of a file into buf, growing it if the file does not fit. The
+ * same buffer is used over and over for every file read into a slot, so
+ * small files cost an open, one read and a close, and nothing else.
+ * Returns 0 with len set to the file's length, or -1 if it could not be read.
+ */
+int load_file(const char *path, char **buf, size_t *size, size_t *len)
+{
+	struct stat st;
+	ssize_t nr;
+	size_t need;
+	char *save;
+	int fd;
+
+	if ((fd = open(path, O_RDONLY)) < 0)
+		return -1;
+
+	/* One byte more than the file so the read that finds the end fits too */
+	need = fstat(fd, &st) < 0 ? READ_BUFFER_SIZE : (size_t) st.st_size + 1;
+	*len = 0;
+	do {
+		if (*len == *size || need > *size) {
+			*size = *size * 2 > need ? *size * 2 : need;
+			save = realloc(*buf, sizeof(char) * *size);
+			if (!save)
+				err(-1, "Error allocating memory.");
+			*buf = save;
 		}
-		toklen++;
-		parser++;
-	}
+		nr = read(fd, *buf + *len, *size - *len);
+		if (nr > 0)
+			*len += nr;
+	} while (nr > 0);
+
+	close(fd);
+	return nr < 0 ? -1 : 0;
 }
 
 /*
- * Sanitizes strings starting with a symbol. Given what the first symbol is
- * it is easy to discern what should follow. If the symbol does not make up
- * the full length of the token, split it in two.
+ * Batch worker thread kickoff. Keeps taking the next file that still needs
+ * to be tokenized, reading it into the file's slot and formatting its
+ * tokens there. For '-o symbols' the tokens are only listed, the same as
+ * in start_worker(), which is why the file has to stay in the slot.
+ * Return Value: NULL.
  */
-void sanitize_symbol(struct input_token **token_node)
-{
-	char *parser = (*token_node)->input;
-	int toklen = 0, full_token_length;
-
-	full_token_length = strlen(parser);
-	switch (*parser) {
-	/* The following symbols can ONLY be themselves */
-	case '(': /* FALLTHROUGH */
-	case ')':
-	case '[':
-	case ']':
-	case '.':
-	case ',':
-	case '!':
-	case '~':
-	case '^':
-	case '?':
-	case ':':
-	/* If we dont know the symbol, just split it off. */
-	default:
-		toklen = 1;
-		break;
+void *start_batch_worker(void *data)
+{
+	struct batch_job *job = data;
+	struct batch_slot *slot;
+	struct lexer lex;
+	const char *path;
+	size_t len;
+	int file;
 
-	/*
-	 * The following symbols can ONLY be themselves: '=', '*', etc.
-	 * or follwing an '=': '==', '*=', '\=', etc.
-	 */
-	case '=': /* FALLTHROUGH */
-	case '*':
-	case '%':
-	case '/':
-		toklen = (parser[1] == '=') ? 2 : 1;
-		break;
+	pthread_mutex_lock(&job->mut);
+	while (1) {
+		while (job->next_file < job->files->count &&
+		       job->next_file >= job->written + job->max_pending)
+			pthread_cond_wait(&job->cond, &job->mut);
+		if (job->next_file == job->files->count)
+			break;
+		file = job->next_file++;
+		pthread_mutex_unlock(&job->mut);
 
-	/*
-	 * '-' is a special case such that it can be alone '-' or following
-	 * '>', '-', or '='
-	 */
-	case '-':
-		if (parser[1] == '>' || parser[1] == '-' || parser[1] == '=')
-			toklen = 2;
-		else
-			toklen = 1;
-		break;
-	/*
-	 * -, |, +, & can can either be themselves: '+', '|', etc.
-	 *  following themselves: '++', '||', etc.
-	 *  or following an equals: '-=', '|=', '+=', '&='
-	 */
-	case '|': /* FALLTHROUGH */
-	case '+':
-	case '&':
-		toklen = (parser[1] == *parser || parser[1] == '=') ? 2 : 1;
-		break;
+		path = job->files->paths[file];
+		slot = &job->slots[file % job->max_pending];
+		if (load_file(path, &slot->data, &slot->size, &len) < 0) {
+			warn("Cannot read '%s'", path);
+			slot->failed = 1;
+		} else {
+			/* Text output says which file the tokens after it came from */
+			if (output_format == OUTPUT_TEXT || output_format == OUTPUT_SYMBOLS)
+				print_token(&slot->out, "file", path, strlen(path));
+			lexer_init(&lex, slot->data, len);
+			if (output_format == OUTPUT_SYMBOLS)
+				create_token_list(&lex, &slot->tokens);
+			else
+				lex_to_output(&lex, &slot->out, 0);
+		}
 
-	/*
-	 * > and < can be either themselves: '>' '<'
-	 * following themselves: '<<' '>>'
-	 * following an equals: '>=' '<='
-	 * or following themselves with an equals: '<<=' '>>='
-	 */
-	case '>': /* FALLTHROUGH */
-	case '<':
-		if (parser[1] == *parser)
-			toklen = (parser[2] == '=') ? 3 : 2;
-		else if (parser[1] == '=')
-			toklen = 2;
-		else
-			toklen = 1;
-		break;
+		pthread_mutex_lock(&job->mut);
+		slot->done = 1;
+		pthread_cond_broadcast(&job->cond);
 	}
-	/* If our symbol doesnt take up the full length of the string. Then split it */
-	if (full_token_length != toklen)
-		split_token(token_node, toklen);
+	pthread_mutex_unlock(&job->mut);
+	return NULL;
 }
 
 /*
- * Kick off function to start sanizing each token within
- * the input token list. Simply looks at the first character
- * of each input string and the sanitize operation is decided
- * on what type of character that is.
+ * Tokenizes every file in the path list on num_threads worker threads.
+ * This works the same as tokenize_parallel() with files in place of
+ * chunks, so the output is the same as tokenizing each file one after
+ * the other, no matter which worker gets to which file first.
+ * Returns the number of files that could not be read.
  */
-void sanitize_tokens(struct input_token **list)
-{
-	const char *token;
-	while (*list) {
-		token = (*list)->input;
-		if (isalpha(*token))
-			sanitize_word(list);
-		else if (isdigit(*token))
-			sanitize_num(list);
-		else
-			sanitize_symbol(list);
-		list = &(*list)->next;
+int tokenize_batch(const struct path_list *files, int num_threads)
+{
+	struct batch_job job;
+	struct batch_slot *slot;
+	pthread_t *pool;
+	int i, failed = 0;
+
+	job.files = files;
+	job.next_file = 0;
+	job.written = 0;
+	job.max_pending = num_threads * PENDING_CHUNKS;
+	pthread_mutex_init(&job.mut, NULL);
+	pthread_cond_init(&job.cond, NULL);
+
+	if (!(job.slots = calloc(job.max_pending, sizeof(*job.slots))))
+		err(-1, "Error allocating memory.");
+	if (!(pool = malloc(sizeof(*pool) * num_threads)))
+		err(-1, "Error allocating memory.");
+	for (i = 0; i < num_threads; i++) {
+		if (pthread_create(&pool[i], NULL, start_batch_worker, &job))
+			errx(1, "Error creating worker thread.");
+	}
+
+	for (i = 0; i < files->count; i++) {
+		slot = &job.slots[i % job.max_pending];
+		pthread_mutex_lock(&job.mut);
+		while (!slot->done)
+			pthread_cond_wait(&job.cond, &job.mut);
+		pthread_mutex_unlock(&job.mut);
+
+		print_tokens(&slot->out, &slot->tokens);
+		slot->tokens.count = 0;
+		write_output(&slot->out);
+		failed += slot->failed;
+
+		pthread_mutex_lock(&job.mut);
+		slot->done = slot->failed = 0;
+		job.written++;
+		pthread_cond_broadcast(&job.cond);
+		pthread_mutex_unlock(&job.mut);
 	}
+
+	for (i = 0; i < num_threads; i++)
+		pthread_join(pool[i], NULL);
+	for (i = 0; i < job.max_pending; i++) {
+		free(job.slots[i].out.data);
+		free_list(&job.slots[i].tokens);
+		free(job.slots[i].data);
+	}
+	pthread_mutex_destroy(&job.mut);
+	pthread_cond_destroy(&job.cond);
+	free(job.slots);
+	free(pool);
+	return failed;
 }
 
 int main(int argc, char **argv)
 {
-	struct input_token *head;
+	struct lexer lex;
+	struct token_list list = {0};
+	struct output_buffer out = {0};
+	struct path_list files = {0};
+	const char *file = NULL;
+	FILE *fp = NULL;
+	char *data;
+	size_t len;
+	int i, found, map = 0, num_threads = 0, batch = 0, failed = 0;
 
-	if (argc < 2)
-		errx(1, "Please include a string to tokenize.\n"
-			" Usage: ./tokenizer <Token string>");
-	if (argc > 2)
-		errx(1, "Too many inputs please input tokens as one string.\n"
-			" Usage: ./tokenizer <Token string>");
+	/* Options only count before the file or string to tokenize */
+	for (i = 1; i + 1 < argc; i += 2) {
+		if (!strcmp(argv[i], "-f") || !strcmp(argv[i], "-m")) {
+			file = argv[i + 1];
+			map = argv[i][1] == 'm';
+		} else if (!strcmp(argv[i], "-b")) {
+			/* Everything after '-b' is a file or directory to tokenize */
+			batch = i + 1;
+			break;
+		} else if (!strcmp(argv[i], "-j")) {
+			num_threads = atoi(argv[i + 1]);
+		} else if (!strcmp(argv[i], "-o")) {
+			for (output_format = OUTPUT_KEYWORDS; output_format >= 0; output_format--) {
+				if (!strcmp(argv[i + 1], output_formats[output_format]))
+					break;
+			}
+			if (output_format < 0)
+				errx(1, "Unknown output format '%s'.\n"
+					" Usage: -o <text | binary | symbols | stats | keywords>", argv[i + 1]);
+		} else {
+			break;
+		}
+	}
+	if (num_threads < 0 || (num_threads && !file && !batch))
+		errx(1, "Threads can only be used to tokenize a file.\n"
+			" Usage: ./tokenizer [-j <threads>] -f <file | ->\n"
+			"        ./tokenizer [-j <threads>] -b <file | dir>...");
 
+	if (batch) {
+		if (output_format == OUTPUT_BINARY)
+			errx(1, "Binary output can only be used to tokenize one file.\n"
+				" Usage: ./tokenizer -o binary -f <file | ->");
+		for (i = batch; i < argc; i++)
+			failed += find_files(&files, argv[i]);
 
-	/* Create token List */
-	head = create_token_list(argv[1]);
-	if (!head)
-		return 1;
+		/* Without '-j' every CPU gets a worker */
+		if (!num_threads && (num_threads = sysconf(_SC_NPROCESSORS_ONLN)) < 1)
+			num_threads = 1;
+		failed += tokenize_batch(&files, num_threads);
+		free_paths(&files);
+		if (output_format == OUTPUT_SYMBOLS)
+			print_symbols();
+		else if (output_format >= OUTPUT_STATS)
+			print_stats();
+		symtab_free(&symbols);
+		return failed ? 1 : 0;
+	}
 
-	/* Sanitize the input list */
-	sanitize_tokens(&head);
+	/* Every binary stream starts with the names of the token types */
+	if (output_format == OUTPUT_BINARY) {
+		put_header(&out);
+		write_output(&out);
+	}
 
-	/* Parse Sanitized Tokens */
-	parse_tokens(head);
-	/* Free memory */
-	free_list(head);
-	return 0;
+	if (file) {
+		if (i != argc)
+			errx(1, "Please input exactly one file to tokenize.\n"
+				" Usage: ./tokenizer [-j <threads>] -f <file | ->\n"
+				"        ./tokenizer [-j <threads>] -m <file>");
+		if (map) {
+			data = map_file(file, &len);
+		} else {
+			if (!strcmp(file, "-"))
+				fp = stdin;
+			else if (!(fp = fopen(file, "r")))
+				err(1, "Cannot open '%s'", file);
+			if (!num_threads) {
+				tokenize_stream(fp);
+				data = NULL;
+				len = 0;
+			} else {
+				data = read_file(fp, &len);
+			}
+			if (fp != stdin)
+				fclose(fp);
+		}
+
+		if (num_threads)
+			tokenize_parallel(data, len, num_threads);
+		else if (map)
+			tokenize_mapped(data, len);
+
+		if (map && data)
+			munmap(data, len);
+		else
+			free(data);
+		free(out.data);
+		if (output_format == OUTPUT_SYMBOLS)
+			print_symbols();
+		else if (output_format >= OUTPUT_STATS)
+			print_stats();
+		symtab_free(&symbols);
+		return 0;
+	}
+
+	if (i == argc)
+		errx(1, "Please include a string to tokenize.\n"
+			" Usage: ./tokenizer <Token string>\n"
+			"        ./tokenizer [-j <threads>] -f <file | ->\n"
+			"        ./tokenizer [-j <threads>] -m <file>\n"
+			"        ./tokenizer [-j <threads>] -b <file | dir>...");
+	if (argc > i + 1)
+		errx(1, "Too many inputs please input tokens as one string.\n"
+			" Usage: ./tokenizer <Token string>");
+
+	/* The command line string is already all in memory */
+	lexer_init(&lex, argv[i], strlen(argv[i]));
+	found = tokenize_buffer(&lex, &list, &out);
+	if (output_format == OUTPUT_SYMBOLS)
+		print_symbols();
+	else if (output_format >= OUTPUT_STATS)
+		print_stats();
+	symtab_free(&symbols);
+	free_list(&list);
+	free(out.data);
+	return found ? 0 : 1;
 }
@@ -0,0 +1,39 @@
+#ifndef _TOKSTREAM_H
+#define _TOKSTREAM_H
+
+/*
+ * Binary token stream format, written by "tokenizer -o binary" and read
+ * back by tokdecode. Tokens are stored as spans of the source, so the
+ * source is needed to get the text of a token back.
+ *
+ * Header:
+ * 	TOKSTREAM_MAGIC, 4 bytes
+ * 	TOKSTREAM_VERSION, 1 byte
+ * 	Number of token types, varint
+ * 	Name of each token type, NUL terminated ("" if it has no name)
+ *
+ * Then one record per token, in the order they appear in the source:
+ * 	Token type + 1, varint
+ * 	Bytes skipped since the end of the last token, varint
+ * 	Length of the token, varint
+ * 	Lines since the last record, varint
+ * 	Column, varint, only if the line changed
+ * A record with a type of 0 only skips bytes and has no length. Positions
+ * start out before the first line, so the first record always has a line
+ * and a column. On the same line as the last record, the column is the
+ * last record's column plus however many bytes are in between.
+ *
+ * Varints are little endian base 128: 7 bits per byte, low bits first,
+ * with the top bit set on every byte but the last.
+ */
+#define TOKSTREAM_MAGIC "CTOK"
+#define TOKSTREAM_MAGIC_LEN 4
+#define TOKSTREAM_VERSION 2
+
+/* A size_t takes at most this many bytes as a varint */
+#define VARINT_MAX_LEN 10
+
+/* Record type that only moves the position in the source forward */
+#define TOKSTREAM_SKIP 0
+
+#endif /* _TOKSTREAM_H */
@@ -1,7 +1,11 @@
+#include <pthread.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <time.h>
 #include <sys/time.h>
+#include <unistd.h>
 
 #include "mymalloc.h"
 
@@ -10,11 +14,81 @@
 #define SIZE_C 240
 #define SIZE_D 64
 #define SIZE_E 120
+#define SIZE_F 120
+#define SIZE_G 40
+#define SIZE_H 64
+#define SIZE_I 64
+#define SIZE_J 64
+
+/* Biggest block workload_F asks for, which spans all of the small size classes */
+#define MAX_SIZE_F 2048
+
+/*
+ * workload_G frees RUN_G blocks that sit next to each other. Its blocks are too big for
+ * the per-thread caches, so freeing one gives it straight back to the heap, and -2
+ * accounts for the meta data so each block spans exactly 1024 bytes.
+ */
+#define RUN_G 16
+#define BLOCK_G (1024 - 2)
+
+/*
+ * workload_I's blocks add up to 512 KiB, twice what an arena holds, and its big blocks
+ * are too big for an arena so each one gets mapped on its own
+ */
+#define BLOCK_I (8 * 1024)
+#define BIG_I (1024 * 1024)
+
+/*
+ * workload_J's threads each malloc SIZE_J blocks of one size class, which is more than a
+ * thread's cache holds for it, so caches get filled and drained over and over
+ */
+#define NUM_THREADS_J 4
+#define BLOCK_J 48
+
+/*
+ * workload_K asks for every power of 2 alignment from 16 up to 4096 bytes, which is as big
+ * as aligned_alloc goes on systems with 4 KiB pages, with each of SIZES_K block sizes
+ */
+#define NUM_ALIGNMENTS_K 9
+#define SIZES_K 4
+
+/* Big enough that workload_L and workload_M's blocks go back to the heap instead of a cache */
+#define BLOCK_L (2048 - 2)
+
+#define NUM_WORKLOADS 13
+
+/* Blocks each of workload_J's threads malloc'd, one row per thread */
+static char *blocks_J[NUM_THREADS_J][SIZE_J];
 
 /* Don't change these */
 #define NUM_LARGE_CHUNKS 32
 #define NUM_SMALL_CHUNKS 96
 
+/*
+ * Purpose: Tells the user when a check a workload makes on the heap fails
+ * Return value: None.
+ */
+static void check(int passed, const char *workload, const char *failure)
+{
+	if (!passed)
+		printf("%s failed: %s\n", workload, failure);
+}
+
+/*
+ * Purpose: Checks that every byte of a block still holds the value it was filled with
+ * Return value: 1 if it does, 0 otherwise.
+ */
+static int filled_with(const char *ptr, size_t size, char c)
+{
+	size_t i;
+
+	for (i = 0; i < size; i++) {
+		if (ptr[i] != c)
+			return 0;
+	}
+	return 1;
+}
+
 /*
  * Purpose: Malloc 1 byte and immediately free it 120 times
  * Return value: None.
@@ -135,18 +209,387 @@ static void workload_E(void)
 	free(ptr);
 }
 
+/*
+ * Purpose: Malloc 120 blocks with sizes spread over the size classes up to 2048 bytes,
+ * free every other one and malloc it again, then check that no two blocks overlap.
+ * Each malloc takes the first block off of its size class's free list instead of
+ * searching the heap for one that fits.
+ * Return value: None.
+ */
+static void workload_F(void)
+{
+	char *arr[SIZE_F];
+	size_t sizes[SIZE_F];
+	int i;
+
+	for (i = 0; i < SIZE_F; i++) {
+		sizes[i] = (i * 97) % MAX_SIZE_F + 1;
+		arr[i] = malloc(sizes[i]);
+		memset(arr[i], i, sizes[i]);
+	}
+
+	for (i = 0; i < SIZE_F; i += 2)
+		free(arr[i]);
+	for (i = 0; i < SIZE_F; i += 2) {
+		arr[i] = malloc(sizes[i]);
+		memset(arr[i], i, sizes[i]);
+	}
+
+	for (i = 0; i < SIZE_F; i++) {
+		check(filled_with(arr[i], sizes[i], i), "workload_F", "blocks overlap");
+		free(arr[i]);
+	}
+}
+
+/*
+ * Purpose: Malloc 40 big blocks and find 17 that came out right after each other. Keep the
+ * first of those and free the other 16 from the middle out like workload E, then grow the
+ * first block over all of them with realloc, which only works in place if every free
+ * combined the block with its free neighbours.
+ * Return value: None.
+ */
+static void workload_G(void)
+{
+	char *arr[SIZE_G];
+	char *grown;
+	int i, j, start, run = 1;
+
+	for (i = 0; i < SIZE_G; i++)
+		arr[i] = malloc(BLOCK_G * sizeof(char));
+
+	for (i = 1; i < SIZE_G && run <= RUN_G; i++)
+		run = ((uintptr_t) arr[i] - (uintptr_t) arr[i - 1] == BLOCK_G + 2) ? run + 1 : 1;
+	start = i - run;
+	check(run > RUN_G, "workload_G", "no blocks came out right after each other");
+
+	if (run > RUN_G) {
+		for (j = RUN_G / 2; j > 0; j--) {
+			free(arr[start + j]);
+			free(arr[start + RUN_G + 1 - j]);
+		}
+		grown = realloc(arr[start], (RUN_G + 1) * (BLOCK_G + 2) - 2);
+		check(grown == arr[start], "workload_G", "freed blocks were not combined");
+		arr[start] = grown;
+		for (j = 1; j <= RUN_G; j++)
+			arr[start + j] = NULL;
+	}
+
+	for (i = 0; i < SIZE_G; i++) {
+		if (arr[i])
+			free(arr[i]);
+	}
+}
+
+/*
+ * Purpose: Frees a pointer that should be turned down with stderr sent to a temporary file,
+ * so the warning can be checked instead of printed.
+ * Return value: 1 if the warning given has warning in it, 0 otherwise.
+ */
+static int free_warns(void *ptr, const char *warning)
+{
+	char given[256] = "";
+	FILE *tmp = tmpfile();
+	int saved_stderr;
+
+	if (!tmp)
+		return 0;
+	fflush(stderr);
+	saved_stderr = dup(STDERR_FILENO);
+	dup2(fileno(tmp), STDERR_FILENO);
+	free(ptr);
+	fflush(stderr);
+	dup2(saved_stderr, STDERR_FILENO);
+	close(saved_stderr);
+
+	rewind(tmp);
+	if (!fgets(given, sizeof(given), tmp))
+		given[0] = '\0';
+	fclose(tmp);
+	return strstr(given, warning) != NULL;
+}
+
+/*
+ * Purpose: Free pointers that were never malloc'd: NULL, one on the stack, one into the
+ * middle of a block, and one 16 bytes into a block, which lines up like a block would so
+ * only the block-start bitmap can tell it apart. Then free a small block, a big block and
+ * a block with a mapping of its own twice. Each bad free should give the warning for what
+ * is wrong with it, leaving the blocks it points into alone.
+ * Return value: None.
+ */
+static void workload_H(void)
+{
+	char *small = malloc(SIZE_H * sizeof(char));
+	char *big = malloc(BLOCK_G * sizeof(char));
+	char *mapped = malloc(BIG_I * sizeof(char));
+	char *small_after, *big_after;
+	char local;
+
+	memset(small, 'h', SIZE_H);
+	memset(big, 'h', BLOCK_G);
+
+	check(free_warns(NULL, "free NULL pointer"), "workload_H", "NULL was not turned down");
+	check(free_warns(&local, "pointer not in range"),
+	      "workload_H", "a pointer on the stack was not turned down");
+	check(free_warns(small + 1, "nonmalloc'd pointer"),
+	      "workload_H", "a pointer into a block was not turned down");
+	check(free_warns(big + 16, "nonmalloc'd pointer"),
+	      "workload_H", "an aligned pointer into a block was not turned down");
+
+	/* Blocks malloc'd now would land on small or big if any of those frees went through */
+	small_after = malloc(SIZE_H * sizeof(char));
+	big_after = malloc(BLOCK_G * sizeof(char));
+	memset(small_after, 0, SIZE_H);
+	memset(big_after, 0, BLOCK_G);
+	check(filled_with(small, SIZE_H, 'h') && filled_with(big, BLOCK_G, 'h'),
+	      "workload_H", "a bad pointer was freed");
+
+	free(small);
+	free(big);
+	free(mapped);
+	check(free_warns(small, "redudantly free"),
+	      "workload_H", "freeing a small block twice was not caught");
+	check(free_warns(big, "redudantly free"),
+	      "workload_H", "freeing a big block twice was not caught");
+	check(free_warns(mapped, "redudantly free"),
+	      "workload_H", "freeing a mapped block twice was not caught");
+	free(small_after);
+	free(big_after);
+}
+
+/*
+ * Purpose: Malloc far more than the 4096 byte heap holds, so that new arenas get mapped,
+ * along with blocks too big for any arena that each get a mapping of their own. Every
+ * block is filled and checked before everything is freed, which unmaps the big blocks
+ * and every arena left empty apart from one spare.
+ * Return value: None.
+ */
+static void workload_I(void)
+{
+	char *arr[SIZE_I];
+	char *big[2];
+	int i;
+
+	for (i = 0; i < SIZE_I; i++) {
+		arr[i] = malloc(BLOCK_I * sizeof(char));
+		memset(arr[i], i, BLOCK_I);
+	}
+	big[0] = malloc(BIG_I * sizeof(char));
+	big[1] = malloc(BIG_I / 4 * sizeof(char));
+	memset(big[0], 'b', BIG_I);
+	memset(big[1], 'B', BIG_I / 4);
+
+	check(filled_with(big[0], BIG_I, 'b') && filled_with(big[1], BIG_I / 4, 'B'),
+	      "workload_I", "big blocks overlap");
+	free(big[0]);
+	free(big[1]);
+	for (i = 0; i < SIZE_I; i++) {
+		check(filled_with(arr[i], BLOCK_I, i), "workload_I", "blocks in arenas overlap");
+		free(arr[i]);
+	}
+}
+
+/*
+ * Purpose: Mallocs one of workload_J's threads' row of blocks, filled with a letter of its own.
+ * Half of them are freed and malloc'd again along the way, which goes through the thread's cache.
+ * Return value: NULL.
+ */
+static void *malloc_thread_J(void *arg)
+{
+	int id = *(int *) arg;
+	char **row = blocks_J[id];
+	int i;
+
+	for (i = 0; i < SIZE_J; i++)
+		row[i] = malloc(BLOCK_J * sizeof(char));
+	for (i = 0; i < SIZE_J; i += 2)
+		free(row[i]);
+	for (i = 0; i < SIZE_J; i++) {
+		if (i % 2 == 0)
+			row[i] = malloc(BLOCK_J * sizeof(char));
+		memset(row[i], 'a' + id, BLOCK_J);
+	}
+	return NULL;
+}
+
+/*
+ * Purpose: Checks and frees the row of blocks the next one of workload_J's threads malloc'd.
+ * Return value: NULL.
+ */
+static void *free_thread_J(void *arg)
+{
+	int owner = (*(int *) arg + 1) % NUM_THREADS_J;
+	char **row = blocks_J[owner];
+	int i;
+
+	for (i = 0; i < SIZE_J; i++) {
+		check(filled_with(row[i], BLOCK_J, 'a' + owner),
+		      "workload_J", "threads were given the same block");
+		free(row[i]);
+	}
+	return NULL;
+}
+
+/*
+ * Purpose: Runs NUM_THREADS_J threads at once and waits for all of them to finish.
+ * Return value: None.
+ */
+static void run_threads_J(void *(*start_routine)(void *))
+{
+	pthread_t threads[NUM_THREADS_J];
+	int ids[NUM_THREADS_J];
+	int i;
+
+	for (i = 0; i < NUM_THREADS_J; i++) {
+		ids[i] = i;
+		if (pthread_create(&threads[i], NULL, start_routine, &ids[i])) {
+			printf("workload_J failed: could not create a thread\n");
+			exit(1);
+		}
+	}
+	for (i = 0; i < NUM_THREADS_J; i++)
+		pthread_join(threads[i], NULL);
+}
+
+/*
+ * Purpose: Have 4 threads malloc small blocks at the same time, then have 4 new threads free
+ * them, each one freeing the blocks a different thread malloc'd. Small blocks come out of and
+ * go back into each thread's own cache without taking the heap's lock, and a thread only
+ * locks the heap to fill or drain its cache 8 blocks at a time.
+ * Return value: None.
+ */
+static void workload_J(void)
+{
+	run_threads_J(malloc_thread_J);
+	run_threads_J(free_thread_J);
+}
+
+/*
+ * Purpose: aligned_alloc blocks of a few sizes at every alignment from 16 to 4096 bytes,
+ * including one too big for an arena, and check that each one is aligned and that none of
+ * them overlap. Plain mallocs of any size should be aligned to 16 bytes.
+ * Return value: None.
+ */
+static void workload_K(void)
+{
+	const size_t sizes[SIZES_K] = {1, 100, 1000, BIG_I / 4};
+	char *blocks[NUM_ALIGNMENTS_K][SIZES_K];
+	char *ptr;
+	size_t alignment;
+	int i, j;
+
+	for (i = 0; i < NUM_ALIGNMENTS_K; i++) {
+		alignment = (size_t) 16 << i;
+		for (j = 0; j < SIZES_K; j++) {
+			blocks[i][j] = aligned_alloc(alignment, sizes[j]);
+			check((uintptr_t) blocks[i][j] % alignment == 0,
+			      "workload_K", "aligned_alloc block is not aligned");
+			memset(blocks[i][j], i * SIZES_K + j, sizes[j]);
+		}
+	}
+
+	for (i = 1; i <= 64; i++) {
+		ptr = malloc(i * sizeof(char));
+		check((uintptr_t) ptr % 16 == 0, "workload_K", "malloc block is not aligned");
+		free(ptr);
+	}
+
+	for (i = 0; i < NUM_ALIGNMENTS_K; i++) {
+		for (j = 0; j < SIZES_K; j++) {
+			check(filled_with(blocks[i][j], sizes[j], i * SIZES_K + j),
+			      "workload_K", "blocks overlap");
+			free(blocks[i][j]);
+		}
+	}
+}
+
+/*
+ * Purpose: Shrink a block with realloc and grow it back, both of which it can do in place,
+ * then grow it too big for an arena and shrink it small enough to fit in one again, both of
+ * which move it. Also shrink a block that has a mapping of its own, which leaves it where it
+ * is. The contents have to make it through every realloc.
+ * Return value: None.
+ */
+static void workload_L(void)
+{
+	char *ptr = malloc(BLOCK_L * sizeof(char));
+	char *resized;
+
+	memset(ptr, 'r', BLOCK_L);
+
+	resized = realloc(ptr, BLOCK_L / 4);
+	check(resized == ptr, "workload_L", "shrinking a block moved it");
+	ptr = resized;
+	resized = realloc(ptr, BLOCK_L);
+	check(resized == ptr,
+	      "workload_L", "growing a block into the free space after it moved it");
+	check(filled_with(resized, BLOCK_L / 4, 'r'),
+	      "workload_L", "realloc lost what was in the block");
+	memset(resized, 'r', BLOCK_L);
+
+	/* Too big for an arena, so it has to move to a mapping of its own */
+	ptr = resized;
+	resized = realloc(ptr, BIG_I);
+	check(resized != ptr, "workload_L", "a block too big for an arena was not moved");
+	check(filled_with(resized, BLOCK_L, 'r'),
+	      "workload_L", "realloc lost what was in the block");
+	memset(resized, 'R', BIG_I);
+
+	/* Still too big for an arena, so it stays in its mapping */
+	ptr = resized;
+	resized = realloc(ptr, BIG_I / 2);
+	check(resized == ptr, "workload_L", "shrinking a big block moved it");
+
+	/* Small enough for an arena again, so it moves back into one */
+	ptr = resized;
+	resized = realloc(ptr, BLOCK_L);
+	check(resized != ptr, "workload_L", "a big block small enough for an arena was not moved");
+	check(filled_with(resized, BLOCK_L, 'R'),
+	      "workload_L", "realloc lost what was in the block");
+
+	check(!realloc(resized, 0), "workload_L", "realloc to 0 bytes did not free the block");
+}
+
+/*
+ * Purpose: Fill blocks and free them, then calloc blocks of the same sizes, which most likely
+ * reuse them, and check that they come back zeroed, along with one too big for an arena.
+ * Also calloc elements whose total size does not fit in a size_t, which has to fail instead
+ * of wrapping around to a small block.
+ * Return value: None.
+ */
+static void workload_M(void)
+{
+	const size_t sizes[3] = {100, BLOCK_L, BIG_I};
+	char *ptr;
+	int i;
+
+	for (i = 0; i < 3; i++) {
+		ptr = malloc(sizes[i] * sizeof(char));
+		memset(ptr, 'c', sizes[i]);
+		free(ptr);
+		ptr = calloc(sizes[i], sizeof(char));
+		check(filled_with(ptr, sizes[i], 0), "workload_M", "calloc block is not zeroed");
+		free(ptr);
+	}
+
+	check(!calloc(SIZE_MAX / 2, 4), "workload_M", "calloc size overflowed");
+}
+
 int main(void)
 {
 	struct timeval start, end;
 	double total_time;
-	double data[50][5];
-	void (*fptr[5])(void) = {workload_A, workload_B, workload_C, workload_D, workload_E};
+	double data[50][NUM_WORKLOADS];
+	void (*fptr[NUM_WORKLOADS])(void) = {
+		workload_A, workload_B, workload_C, workload_D, workload_E, workload_F,
+		workload_G, workload_H, workload_I, workload_J, workload_K, workload_L,
+		workload_M
+	};
 	int i, j;
 
 	/* Run each workload and store the runtime into a 2D array */
 	srand(time(0));
 	for (i = 0; i < 50; i++) {
-		for (j = 0; j < 5; j++) {
+		for (j = 0; j < NUM_WORKLOADS; j++) {
 			gettimeofday(&start, NULL);
 			fptr[j]();
 			gettimeofday(&end, NULL);
@@ -155,7 +598,7 @@ int main(void)
 		}
 	}
 
-	for (j = 0; j < 5; j++) {
+	for (j = 0; j < NUM_WORKLOADS; j++) {
 		total_time = 0;
 		for (i = 0; i < 50; i++)
 			total_time += data[i][j];
@@ -1,20 +1,195 @@
+#include <pthread.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
 #include "mymalloc.h"
 
 #define WARN(x) log_warn(x, filename, line_number)
 
-/* Only change this value to configure heap size */
+/* Only change this value to configure heap size, a multiple of 128 up to 262016 */
 #define HEAP_SIZE 4096
 
-/* Data structure used to access our values stored in our header data. */
+/*
+ * Once the heap runs out, more blocks come from arenas of ARENA_SIZE bytes
+ * mapped in with mmap. Every mapping starts on a multiple of ARENA_SIZE, so
+ * the arena a block is in starts at the block's address rounded down to one.
+ */
+#define ARENA_SHIFT 18
+#define ARENA_SIZE (1 << ARENA_SHIFT)
+
+/*
+ * Every mapping can be found from any address in it with arena_map, which
+ * has an entry for each ARENA_SIZE bytes of the lowest 2^ADDRESS_BITS bytes
+ * of address space, split into leaves of 2^MAP_LEAF_BITS entries that are
+ * only mapped once a mapping needs one.
+ */
+#define ADDRESS_BITS 48
+#define MAP_LEAF_BITS 16
+#define MAP_ROOT_BITS (ADDRESS_BITS - ARENA_SHIFT - MAP_LEAF_BITS)
+
+/*
+ * Each thread keeps up to TCACHE_COUNT blocks of each small size class
+ * that it can give out and take back without locking the heap. An empty
+ * cache is filled and a full one is drained TCACHE_FILL blocks at a time.
+ */
+#define TCACHE_COUNT 16
+#define TCACHE_FILL 8
+
+/*
+ * A big block's mapping is gone once it is freed, so the last FREED_BIG_BLOCKS
+ * of them are remembered to tell freeing one again apart from a pointer
+ * that was never ours.
+ */
+#define FREED_BIG_BLOCKS 16
+
+/*
+ * Every pointer mymalloc gives out is aligned to ALIGNMENT bytes. A block's
+ * header sits in the 2 bytes right before its user space, so blocks are
+ * laid out in steps of ALIGNMENT bytes, each a header and the user space
+ * up to the next header.
+ */
+#define ALIGNMENT 16
+
+/*
+ * Data structure used to access our values stored in our header data.
+ * block_size is how many ALIGNMENT byte steps the header and user space
+ * take up together. It is 0 for a block too big for an arena, which gets a
+ * mapping all to itself that knows its size. prev_free is set when the
+ * block right before this one is free, which means the last 2 bytes of that
+ * block are its footer.
+ */
 struct header_data {
-	unsigned short block_size: 15;
+	unsigned short block_size: 14;
+	unsigned short prev_free: 1;
 	unsigned short free: 1;
 };
 
-static char heap[HEAP_SIZE] = {0};
+/*
+ * Links of a free block to the blocks before and after it on its free list,
+ * kept in the block's user space.
+ */
+struct free_links {
+	struct header_data *next;
+	struct header_data *prev;
+};
+
+/*
+ * A block in a thread's cache, which is allocated as far as the heap can
+ * tell. key is TCACHE_KEY for as long as the block is in a cache, which is
+ * how freeing it again gets caught.
+ */
+struct tcache_entry {
+	struct tcache_entry *next;
+	const void *key;
+};
+
+/*
+ * Arena struct, for the static heap and every mapping. Blocks go from start
+ * up to end, where a header that is never free fences them in so the last
+ * block has a block after it like every other one. block_starts has a bit
+ * for every ALIGNMENT bytes from start, set where a block's header starts.
+ * A mapping for one block too big for an arena has no block_starts, its
+ * block's user space runs up to end. map_size is 0 for the static heap.
+ */
+struct arena {
+	char *start;
+	char *end;
+	unsigned char *block_starts;
+	size_t map_size;
+};
+
+/* Rounds n up to a multiple of align, which has to be a power of 2 */
+#define ROUND_UP(n, align) (((n) + (align) - 1) & ~(size_t) ((align) - 1))
+
+/* Rounds a size up to the user space of the smallest block that can hold it */
+#define BLOCK_ROUND(size) \
+	(ROUND_UP((size) + sizeof(struct header_data), ALIGNMENT) - sizeof(struct header_data))
+
+/*
+ * Smallest user space a block can have, so it can hold its links and its
+ * footer, a copy of its size at the very end, once it is freed.
+ */
+#define MIN_BLOCK_SIZE BLOCK_ROUND(sizeof(struct free_links) + sizeof(unsigned short))
+
+/*
+ * Size classes, going by how many bytes a block takes up with its header.
+ * Every block of up to SMALL_CLASS_MAX bytes has a class of its own size,
+ * so any block on one of their free lists fits. Bigger blocks share a class
+ * with every block up to the next power of 2.
+ */
+#define SMALL_CLASS_SHIFT 9
+#define SMALL_CLASS_MAX (1 << SMALL_CLASS_SHIFT)
+#define NUM_SMALL_CLASSES ((int) (SMALL_CLASS_MAX - MIN_BLOCK_SIZE - sizeof(struct header_data)) / ALIGNMENT + 1)
+#define NUM_CLASSES (NUM_SMALL_CLASSES + ARENA_SHIFT - SMALL_CLASS_SHIFT)
+
+/*
+ * A mapped arena starts with its arena struct and bitmap, then its blocks,
+ * whose first header goes 2 bytes before a multiple of ALIGNMENT.
+ */
+#define ARENA_BITMAP_SIZE (ARENA_SIZE / ALIGNMENT / 8)
+#define ARENA_BLOCKS_OFFSET BLOCK_ROUND(sizeof(struct arena) + ARENA_BITMAP_SIZE)
+
+/* Most user space a block in an arena can have, bigger blocks get mapped on their own */
+#define MAX_ARENA_BLOCK (ARENA_SIZE - ARENA_BLOCKS_OFFSET - 2 * sizeof(struct header_data))
+
+/* Fails to compile if block sizes in the heap or an arena would not fit in 14 bits */
+typedef char check_heap_size[HEAP_SIZE / ALIGNMENT < 16384 && HEAP_SIZE % (8 * ALIGNMENT) == 0 ? 1 : -1];
+typedef char check_arena_size[ARENA_SIZE / ALIGNMENT <= 16384 ? 1 : -1];
+typedef char check_header[sizeof(struct header_data) == sizeof(unsigned short) ? 1 : -1];
+typedef char check_tcache_entry[sizeof(struct tcache_entry) <= MIN_BLOCK_SIZE ? 1 : -1];
+typedef char check_num_classes[NUM_CLASSES <= 64 ? 1 : -1];
+
+/*
+ * The heap's blocks start 2 bytes before ALIGNMENT bytes in, and there is
+ * room after them for the header that fences them in.
+ */
+static char heap[HEAP_SIZE + ALIGNMENT] __attribute__((aligned(ALIGNMENT))) = {0};
+static unsigned char heap_block_starts[HEAP_SIZE / ALIGNMENT / 8];
+static struct arena main_arena = {
+	heap + ALIGNMENT - sizeof(struct header_data),
+	heap + ALIGNMENT - sizeof(struct header_data) + HEAP_SIZE,
+	heap_block_starts, 0
+};
+
+/*
+ * Everything from here down to page_size is shared by every thread and
+ * only touched with heap_lock held, apart from arena_map and the bitmaps,
+ * which are updated atomically so myfree can look pointers up without it.
+ */
+static pthread_mutex_t heap_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t heap_once = PTHREAD_ONCE_INIT;
+
+/* First block of each size class's free list, and a bit for each non-empty one */
+static struct header_data *free_lists[NUM_CLASSES];
+static unsigned long long nonempty_classes;
+
+/* Leaves are never unmapped, so looking an address up is safe at any time */
+static struct arena **arena_map[1 << MAP_ROOT_BITS];
+
+/* An arena with nothing in it, kept instead of unmapped so the next one does not have to be mapped */
+static struct arena *spare_arena;
+
+static size_t page_size;
+
+/* User space of the big blocks unmapped most recently, the oldest replaced first */
+static void *freed_big_blocks[FREED_BIG_BLOCKS];
+static unsigned int next_freed_big_block;
+
+/* Each thread's cache of small blocks, given back to the heap when the thread exits */
+static __thread struct tcache {
+	struct tcache_entry *entries[NUM_SMALL_CLASSES];
+	unsigned int counts[NUM_SMALL_CLASSES];
+	int registered;
+} tcache;
+static pthread_key_t tcache_exit_key;
+
+/* Only its address is used, nothing a user can put in a block is ever equal to it */
+static const char tcache_key;
+#define TCACHE_KEY ((const void *) &tcache_key)
 
 /*
  * Purpose: Print warning message to user that something that has gone wrong, but
@@ -27,149 +202,766 @@ static inline void log_warn(const char *warning, const char *fname, int line_num
 }
 
 /*
- * Purpose: Initlialize the first 2 bytes of the heap to be meta data. This
- * allows future blocks to be built and split off from this first block.
+ * Purpose: Finds how much user space a block in an arena has.
+ * Return Value: Size of the block in bytes.
+ */
+static inline size_t block_size(const struct header_data *meta)
+{
+	return (size_t) meta->block_size * ALIGNMENT - sizeof(*meta);
+}
+
+/*
+ * Purpose: Sets how much user space a block in an arena has.
  * Return Value: None.
  */
-static inline void initialize_heap(void)
+static inline void set_block_size(struct header_data *meta, size_t size)
 {
-	struct header_data *meta = (struct header_data *) heap;
+	meta->block_size = (size + sizeof(*meta)) / ALIGNMENT;
+}
 
-	meta->block_size = HEAP_SIZE - sizeof(*meta);
+/*
+ * Purpose: Copies a header out with one atomic load. The prev_free bit of
+ * an allocated block can be changed by whichever thread holds heap_lock
+ * while the block's owner looks at its header without it.
+ * Return Value: None.
+ */
+static inline void load_header(const struct header_data *meta, struct header_data *copy)
+{
+	unsigned short bits = __atomic_load_n((const unsigned short *) meta, __ATOMIC_RELAXED);
+
+	memcpy(copy, &bits, sizeof(bits));
+}
+
+/*
+ * Purpose: Sets the prev_free bit of a block that might be allocated, with
+ * one atomic store so its owner never sees half of it. heap_lock has to be
+ * held.
+ * Return Value: None.
+ */
+static inline void set_prev_free(struct header_data *meta, int prev_free)
+{
+	struct header_data copy = *meta;
+	unsigned short bits;
+
+	copy.prev_free = prev_free;
+	memcpy(&bits, &copy, sizeof(bits));
+	__atomic_store_n((unsigned short *) meta, bits, __ATOMIC_RELAXED);
+}
+
+/*
+ * Purpose: Finds where a free block keeps its links.
+ * Return Value: Pointer to the links.
+ */
+static inline struct free_links *links_of(struct header_data *meta)
+{
+	return (struct free_links *) (meta + 1);
+}
+
+/*
+ * Purpose: Finds the arena a block is in, which has to be a block given out
+ * by or kept in one of our arenas.
+ * Return Value: Pointer to the arena.
+ */
+static inline struct arena *arena_of(void *ptr)
+{
+	char *block_ptr = ptr;
+
+	if (block_ptr >= heap && block_ptr < heap + sizeof(heap))
+		return &main_arena;
+	return (struct arena *) ((uintptr_t) ptr & ~(uintptr_t) (ARENA_SIZE - 1));
+}
+
+/*
+ * Purpose: Records that a block's header starts where meta is, or that it
+ * no longer does once the block has been combined into the one before it.
+ * Return Value: None.
+ */
+static inline void mark_block(struct header_data *meta, int is_start)
+{
+	struct arena *arena = arena_of(meta);
+	size_t unit = ((char *) meta - arena->start) / ALIGNMENT;
+
+	if (is_start)
+		__atomic_fetch_or(&arena->block_starts[unit / 8], 1 << unit % 8, __ATOMIC_RELAXED);
+	else
+		__atomic_fetch_and(&arena->block_starts[unit / 8], ~(1 << unit % 8), __ATOMIC_RELAXED);
+}
+
+/*
+ * Purpose: Finds the block right after a block. The last block of an arena
+ * has the arena's fence after it, which is never free.
+ * Return Value: Pointer to its header.
+ */
+static inline struct header_data *next_block(struct header_data *meta)
+{
+	return (struct header_data *) ((char *) (meta + 1) + block_size(meta));
+}
+
+/*
+ * Purpose: Finds the block right before a block, which has to be free.
+ * Return Value: Pointer to its header.
+ */
+static inline struct header_data *prev_block(struct header_data *meta)
+{
+	unsigned short *footer = (unsigned short *) meta - 1;
+
+	return (struct header_data *) ((char *) meta - (size_t) *footer * ALIGNMENT);
+}
+
+/*
+ * Purpose: Marks a block as free, copying its size into its footer and
+ * telling the block after it.
+ * Return Value: None.
+ */
+static void set_free(struct header_data *meta)
+{
 	meta->free = 1;
+	*(unsigned short *) ((char *) next_block(meta) - sizeof(unsigned short)) = meta->block_size;
+	set_prev_free(next_block(meta), 1);
+}
+
+/*
+ * Purpose: Finds which size class a block of size bytes belongs to.
+ * Return Value: Index of the class.
+ */
+static inline int size_class(size_t size)
+{
+	size_t span = size + sizeof(struct header_data);
+
+	if (span <= SMALL_CLASS_MAX)
+		return (size - MIN_BLOCK_SIZE) / ALIGNMENT;
+	return NUM_SMALL_CLASSES + (63 - __builtin_clzll(span - 1)) - SMALL_CLASS_SHIFT;
+}
+
+/*
+ * Purpose: Puts a free block at the front of its size class's free list.
+ * Return Value: None.
+ */
+static void insert_free_block(struct header_data *meta)
+{
+	struct free_links *links = links_of(meta);
+	int class = size_class(block_size(meta));
+
+	links->prev = NULL;
+	links->next = free_lists[class];
+	if (links->next)
+		links_of(links->next)->prev = meta;
+	free_lists[class] = meta;
+	nonempty_classes |= 1ULL << class;
+}
+
+/*
+ * Purpose: Takes a free block off of its size class's free list.
+ * Return Value: None.
+ */
+static void remove_free_block(struct header_data *meta)
+{
+	struct free_links *links = links_of(meta);
+	int class = size_class(block_size(meta));
+
+	if (links->prev)
+		links_of(links->prev)->next = links->next;
+	else if (!(free_lists[class] = links->next))
+		nonempty_classes &= ~(1ULL << class);
+	if (links->next)
+		links_of(links->next)->prev = links->prev;
+}
+
+/*
+ * Purpose: Finds a free block with at least size bytes of user space. Only
+ * the free list of size's own class is searched, and only when it is one of
+ * the bigger classes, since every block on a higher list fits and the first
+ * one of those is taken.
+ * Return Value: Pointer to the block's header, NULL if there is none.
+ */
+static struct header_data *find_free_block(size_t size)
+{
+	struct header_data *meta;
+	unsigned long long classes;
+	int class = size_class(size);
+
+	if (class >= NUM_SMALL_CLASSES) {
+		for (meta = free_lists[class]; meta; meta = links_of(meta)->next) {
+			if (block_size(meta) >= size)
+				return meta;
+		}
+		class++;
+	}
+	classes = nonempty_classes >> class << class;
+	if (!classes)
+		return NULL;
+	return free_lists[__builtin_ctzll(classes)];
+}
+
+/*
+ * Purpose: Finds the mapping the ARENA_SIZE bytes an address is in belong
+ * to, without needing heap_lock.
+ * Return Value: Pointer to the mapping, NULL if they are not in one.
+ */
+static struct arena *lookup_arena(const void *ptr)
+{
+	uintptr_t index = (uintptr_t) ptr >> ARENA_SHIFT;
+	struct arena **leaf;
+
+	if (index >> (MAP_ROOT_BITS + MAP_LEAF_BITS))
+		return NULL;
+	leaf = __atomic_load_n(&arena_map[index >> MAP_LEAF_BITS], __ATOMIC_ACQUIRE);
+	if (!leaf)
+		return NULL;
+	return __atomic_load_n(&leaf[index & ((1 << MAP_LEAF_BITS) - 1)], __ATOMIC_ACQUIRE);
 }
 
 /*
- * Purpose: Returns a pointer to a chunk of memory in our "heap".
+ * Purpose: Points the arena_map entries for every ARENA_SIZE bytes of a
+ * mapping at value. The leaves have to already be there.
+ * Return Value: None.
+ */
+static void set_arena_map(struct arena *arena, struct arena *value)
+{
+	uintptr_t index = (uintptr_t) arena >> ARENA_SHIFT;
+	uintptr_t last = ((uintptr_t) arena + arena->map_size - 1) >> ARENA_SHIFT;
+
+	for (; index <= last; index++)
+		__atomic_store_n(&arena_map[index >> MAP_LEAF_BITS][index & ((1 << MAP_LEAF_BITS) - 1)],
+				 value, __ATOMIC_RELEASE);
+}
+
+/*
+ * Purpose: Adds a mapping to arena_map, first mapping any leaves it needs.
+ * Return Value: 0 on success, -1 if it is out of arena_map's range or a
+ * leaf could not be mapped.
+ */
+static int add_arena(struct arena *arena)
+{
+	uintptr_t index = (uintptr_t) arena >> ARENA_SHIFT;
+	uintptr_t last = ((uintptr_t) arena + arena->map_size - 1) >> ARENA_SHIFT;
+	struct arena **leaf;
+
+	if (last >> (MAP_ROOT_BITS + MAP_LEAF_BITS))
+		return -1;
+	for (index >>= MAP_LEAF_BITS; index <= last >> MAP_LEAF_BITS; index++) {
+		if (arena_map[index])
+			continue;
+		leaf = mmap(NULL, sizeof(*leaf) << MAP_LEAF_BITS, PROT_READ | PROT_WRITE,
+			    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (leaf == MAP_FAILED)
+			return -1;
+		__atomic_store_n(&arena_map[index], leaf, __ATOMIC_RELEASE);
+	}
+	set_arena_map(arena, arena);
+	return 0;
+}
+
+/*
+ * Purpose: Unmaps a mapping and takes it out of arena_map.
+ * Return Value: None.
+ */
+static void unmap_arena(struct arena *arena)
+{
+	set_arena_map(arena, NULL);
+	munmap(arena, arena->map_size);
+}
+
+/*
+ * Purpose: Maps size bytes, which has to be a multiple of the page size,
+ * starting on a multiple of ARENA_SIZE. Enough is mapped that a multiple
+ * is in there somewhere, and what is around it gets unmapped.
+ * Return Value: Pointer to the mapping, NULL if it could not be made.
+ */
+static char *map_aligned(size_t size)
+{
+	char *map = mmap(NULL, size + ARENA_SIZE, PROT_READ | PROT_WRITE,
+			 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	char *base;
+
+	if (map == MAP_FAILED)
+		return NULL;
+	base = map + (ARENA_SIZE - (uintptr_t) map % ARENA_SIZE) % ARENA_SIZE;
+	if (base > map)
+		munmap(map, base - map);
+	munmap(base + size, map + ARENA_SIZE - base);
+	return base;
+}
+
+/*
+ * Purpose: Makes all of an arena one free block, and puts the fence after it.
+ * Return Value: None.
+ */
+static void start_arena(struct arena *arena)
+{
+	struct header_data *meta = (struct header_data *) arena->start;
+	struct header_data *fence = (struct header_data *) arena->end;
+
+	set_block_size(meta, arena->end - arena->start - sizeof(*meta));
+	meta->prev_free = 0;
+	fence->block_size = 0;
+	fence->free = 0;
+	set_free(meta);
+	insert_free_block(meta);
+	mark_block(meta, 1);
+}
+
+/*
+ * Purpose: Maps a new arena and puts its block on the free lists.
+ * Return Value: 0 on success, -1 if it could not be mapped.
+ */
+static int new_arena(void)
+{
+	struct arena *arena = (struct arena *) map_aligned(ARENA_SIZE);
+
+	if (!arena)
+		return -1;
+	arena->start = (char *) arena + ARENA_BLOCKS_OFFSET;
+	arena->end = (char *) arena + ARENA_SIZE - sizeof(struct header_data);
+	arena->block_starts = (unsigned char *) (arena + 1);
+	arena->map_size = ARENA_SIZE;
+	if (add_arena(arena) < 0) {
+		munmap(arena, ARENA_SIZE);
+		return -1;
+	}
+	start_arena(arena);
+	return 0;
+}
+
+/*
+ * Purpose: Maps a block too big for an arena all on its own, with enough
+ * pages for its header and size bytes of user space starting on a multiple
+ * of alignment, which can be up to the page size.
+ * Return Value: Pointer to the block's user space, NULL if it could not be mapped.
+ */
+static void *map_big_block(size_t size, size_t alignment)
+{
+	size_t offset = ROUND_UP(sizeof(struct arena) + sizeof(struct header_data), alignment);
+	struct header_data *meta;
+	struct arena *arena;
+	size_t map_size;
+
+	if (size > SIZE_MAX - offset - ARENA_SIZE - page_size)
+		return NULL;
+	map_size = ROUND_UP(offset + size, page_size);
+	if (!(arena = (struct arena *) map_aligned(map_size)))
+		return NULL;
+	arena->start = (char *) arena + offset - sizeof(*meta);
+	arena->end = (char *) arena + map_size;
+	arena->block_starts = NULL;
+	arena->map_size = map_size;
+	meta = (struct header_data *) arena->start;
+	meta->block_size = 0;
+	meta->prev_free = 0;
+	meta->free = 0;
+	pthread_mutex_lock(&heap_lock);
+	if (add_arena(arena) < 0) {
+		pthread_mutex_unlock(&heap_lock);
+		munmap(arena, map_size);
+		return NULL;
+	}
+	pthread_mutex_unlock(&heap_lock);
+	return (void *) (meta + 1);
+}
+
+/*
+ * Purpose: Combines a block that was just freed with the blocks on either
+ * side of it if they are free too, which the boundary tags say without
+ * looking at any other block. Blocks that get combined are taken off of
+ * their free lists.
+ * Return Value: Pointer to the header of the combined block.
+ */
+static struct header_data *coalesce_blocks(struct header_data *meta)
+{
+	struct header_data *next_meta = next_block(meta), *prev_meta;
+
+	if (next_meta->free) {
+		remove_free_block(next_meta);
+		mark_block(next_meta, 0);
+		set_block_size(meta, block_size(meta) + block_size(next_meta) + sizeof(*next_meta));
+	}
+	if (meta->prev_free) {
+		prev_meta = prev_block(meta);
+		remove_free_block(prev_meta);
+		mark_block(meta, 0);
+		set_block_size(prev_meta, block_size(prev_meta) + block_size(meta) + sizeof(*meta));
+		meta = prev_meta;
+	}
+	return meta;
+}
+
+/*
+ * Purpose: Gives an allocated block in an arena back to the heap. Arenas
+ * that end up with nothing in them are unmapped, apart from one spare.
+ * heap_lock has to be held.
+ * Return Value: None.
+ */
+static void release_block(struct arena *arena, struct header_data *meta)
+{
+	/* Combine the block with its free neighbours */
+	meta = coalesce_blocks(meta);
+	set_free(meta);
+	insert_free_block(meta);
+	if (arena->map_size && (char *) meta == arena->start &&
+	    (char *) next_block(meta) == arena->end) {
+		if (!spare_arena) {
+			spare_arena = arena;
+		} else {
+			remove_free_block(meta);
+			unmap_arena(arena);
+		}
+	}
+}
+
+/*
+ * Purpose: Cuts an allocated block down to size bytes of user space, giving
+ * what is left over back to the heap if it is big enough to be a block of
+ * its own. heap_lock has to be held.
+ * Return Value: None.
+ */
+static void split_block(struct header_data *meta, size_t size)
+{
+	struct header_data *next_meta;
+	size_t remaining = block_size(meta) - size;
+
+	if (remaining < sizeof(*next_meta) + MIN_BLOCK_SIZE)
+		return;
+	set_block_size(meta, size);
+	next_meta = next_block(meta);
+	set_block_size(next_meta, remaining - sizeof(*next_meta));
+	next_meta->prev_free = 0;
+	next_meta->free = 0;
+	mark_block(next_meta, 1);
+	release_block(arena_of(next_meta), next_meta);
+}
+
+/*
+ * Purpose: Gives count blocks from the front of this thread's cache of a
+ * size class back to the heap. heap_lock has to be held.
+ * Return Value: None.
+ */
+static void drain_tcache(int class, unsigned int count)
+{
+	struct tcache_entry *entry;
+
+	while (count-- && (entry = tcache.entries[class])) {
+		tcache.entries[class] = entry->next;
+		tcache.counts[class]--;
+		entry->key = NULL;
+		release_block(arena_of(entry), (struct header_data *) entry - 1);
+	}
+}
+
+/*
+ * Purpose: Gives every block in this thread's cache back to the heap, which
+ * happens when the thread exits. heap_lock must not be held.
+ * Return Value: None.
+ */
+static void flush_tcache(void *unused)
+{
+	int class;
+
+	(void) unused;
+	pthread_mutex_lock(&heap_lock);
+	for (class = 0; class < NUM_SMALL_CLASSES; class++)
+		drain_tcache(class, tcache.counts[class]);
+	pthread_mutex_unlock(&heap_lock);
+	tcache.registered = 0;
+}
+
+/*
+ * Purpose: Makes sure this thread's cache gets flushed when it exits.
+ * Return Value: None.
+ */
+static inline void register_tcache(void)
+{
+	if (!tcache.registered) {
+		pthread_setspecific(tcache_exit_key, &tcache);
+		tcache.registered = 1;
+	}
+}
+
+/*
+ * Purpose: Takes a free block with at least size bytes of user space out of
+ * the heap, splitting off what it does not need. Before mapping a new arena,
+ * this thread's cache is given back in case that makes room.
+ * heap_lock has to be held.
+ * Return Value: Pointer to the block's header, NULL if the heap is out of memory.
+ */
+static struct header_data *take_block(size_t size)
+{
+	struct header_data *meta;
+	int class;
+
+	if (!(meta = find_free_block(size))) {
+		for (class = 0; class < NUM_SMALL_CLASSES; class++)
+			drain_tcache(class, tcache.counts[class]);
+		if (!(meta = find_free_block(size)) && new_arena() == 0)
+			meta = find_free_block(size);
+		if (!meta)
+			return NULL;
+	}
+	remove_free_block(meta);
+	if (spare_arena && (char *) meta == spare_arena->start)
+		spare_arena = NULL;
+
+	meta->free = 0;
+	set_prev_free(next_block(meta), 0);
+	split_block(meta, size);
+	return meta;
+}
+
+/*
+ * Purpose: Fills this thread's empty cache of a size class with up to
+ * TCACHE_FILL blocks of size bytes, all taken while holding heap_lock once.
+ * Return Value: None.
+ */
+static void fill_tcache(int class, size_t size)
+{
+	struct tcache_entry *entry;
+	struct header_data *meta;
+	int i;
+
+	register_tcache();
+	pthread_mutex_lock(&heap_lock);
+	for (i = 0; i < TCACHE_FILL && (meta = take_block(size)); i++) {
+		entry = (struct tcache_entry *) (meta + 1);
+		entry->next = tcache.entries[class];
+		entry->key = TCACHE_KEY;
+		tcache.entries[class] = entry;
+		tcache.counts[class]++;
+	}
+	pthread_mutex_unlock(&heap_lock);
+}
+
+/*
+ * Purpose: Initlialize the first 2 bytes of the heap to be meta data. This
+ * allows future blocks to be built and split off from this first block.
+ * Only ever runs once, through pthread_once.
+ * Return Value: None.
+ */
+static void initialize_heap(void)
+{
+	page_size = sysconf(_SC_PAGESIZE);
+	pthread_key_create(&tcache_exit_key, flush_tcache);
+	start_arena(&main_arena);
+}
+
+/*
+ * Purpose: Returns a pointer to a chunk of memory in our "heap". Small blocks
+ * come out of the thread's cache, everything else is taken from the heap
+ * with heap_lock held. A new arena is mapped when no free block fits, and
+ * blocks too big for one are mapped on their own.
  * Return Value: Pointer to the first byte of allocated memory.
  */
 void *mymalloc(size_t size, const char *filename, int line_number)
 {
+	struct tcache_entry *entry;
 	struct header_data *meta;
-	static int initialized = 0;
-	char *heap_byte = heap;
-	const char *const heap_boundary = heap + HEAP_SIZE;
+	void *ptr;
+	int class;
 
 	if (!size)
 		return NULL;
 
-	if (!initialized) {
-		initialize_heap();
-		initialized = 1;
-	}
+	pthread_once(&heap_once, initialize_heap);
 
-	/* Go through the heap to find an empty block that can fit the requested size. */
-	do {
-		meta = (struct header_data *) heap_byte;
-		if (meta->free && (meta->block_size >= size))
-			break;
-		heap_byte += sizeof(*meta) + meta->block_size;
-	} while (heap_byte < heap_boundary);
+	if (size > MAX_ARENA_BLOCK) {
+		if (!(ptr = map_big_block(size, ALIGNMENT)))
+			WARN("Heap out of memory.");
+		return ptr;
+	}
 
-	/* Heap byte now becomes the pointer to mutable memory we return to the user. */
-	heap_byte += sizeof(*meta);
+	/* Sizes are rounded up so the next block's user space is aligned too */
+	size = size < MIN_BLOCK_SIZE ? MIN_BLOCK_SIZE : BLOCK_ROUND(size);
+	if (size + sizeof(*meta) <= SMALL_CLASS_MAX) {
+		class = size_class(size);
+		if (!tcache.entries[class])
+			fill_tcache(class, size);
+		if (!(entry = tcache.entries[class])) {
+			WARN("Heap out of memory.");
+			return NULL;
+		}
+		tcache.entries[class] = entry->next;
+		tcache.counts[class]--;
+		entry->key = NULL;
+		return (void *) entry;
+	}
 
-	/* Ensure that the byte that we return to the user is not out of bounds */
-	if (heap_byte >= heap_boundary) {
+	pthread_mutex_lock(&heap_lock);
+	meta = take_block(size);
+	pthread_mutex_unlock(&heap_lock);
+	if (!meta) {
 		WARN("Heap out of memory.");
 		return NULL;
 	}
+	return (void *) (meta + 1);
+}
 
-	/* If our block is bigger than our requested size we need to split the block. */
-	if (meta->block_size > size) {
-		struct header_data *next_meta = (struct header_data *) (heap_byte + size);
-		/* When we split the block, will our split block header data fit? */
-		if ((char *)(next_meta + 1) <= heap_boundary) {
-			next_meta->free = 1;
-			next_meta->block_size = meta->block_size - (size + sizeof(*next_meta));
-		}
+/*
+ * Purpose: Returns a pointer to a chunk of memory in our "heap" that starts
+ * on a multiple of alignment, which has to be a power of 2 up to the page
+ * size. A block with room to spare is taken from the heap, and the space in
+ * front of the aligned spot and after the size bytes it needs is given back
+ * as blocks of their own, so the most that is lost to the alignment is
+ * what is too small to be a block.
+ * Return Value: Pointer to the first byte of allocated memory.
+ */
+void *myaligned_alloc(size_t alignment, size_t size, const char *filename, int line_number)
+{
+	struct header_data *meta, *aligned_meta;
+	char *aligned;
+	size_t gap;
+	void *ptr;
+
+	if (!size)
+		return NULL;
+
+	pthread_once(&heap_once, initialize_heap);
 
+	if (!alignment || alignment & (alignment - 1) || alignment > page_size) {
+		WARN("Alignment is not a power of 2 up to the page size.");
+		return NULL;
 	}
-	meta->free = 0;
-	meta->block_size = size;
-	return (void *) heap_byte;
+	if (alignment <= ALIGNMENT)
+		return mymalloc(size, filename, line_number);
+
+	if (size > MAX_ARENA_BLOCK - alignment - ALIGNMENT) {
+		if (!(ptr = map_big_block(size, alignment)))
+			WARN("Heap out of memory.");
+		return ptr;
+	}
+
+	/*
+	 * The block in front of the aligned spot has to be big enough to be
+	 * a block, so the spot can be up to alignment + ALIGNMENT bytes in.
+	 */
+	size = size < MIN_BLOCK_SIZE ? MIN_BLOCK_SIZE : BLOCK_ROUND(size);
+	pthread_mutex_lock(&heap_lock);
+	if (!(meta = take_block(size + alignment + ALIGNMENT))) {
+		pthread_mutex_unlock(&heap_lock);
+		WARN("Heap out of memory.");
+		return NULL;
+	}
+	aligned = (char *) ROUND_UP((uintptr_t) (meta + 1), alignment);
+	gap = aligned - (char *) (meta + 1);
+	if (gap && gap < sizeof(*meta) + MIN_BLOCK_SIZE) {
+		aligned += alignment;
+		gap += alignment;
+	}
+
+	/* Give the space in front back as a block of its own */
+	if (gap) {
+		aligned_meta = (struct header_data *) aligned - 1;
+		set_block_size(aligned_meta, block_size(meta) - gap);
+		aligned_meta->prev_free = 0;
+		aligned_meta->free = 0;
+		mark_block(aligned_meta, 1);
+		set_block_size(meta, gap - sizeof(*meta));
+		release_block(arena_of(meta), meta);
+		meta = aligned_meta;
+	}
+	split_block(meta, size);
+	pthread_mutex_unlock(&heap_lock);
+	return (void *) (meta + 1);
 }
 
 /*
- * Purpose: Takes in a pointer and tests to see if it is in range of our heap.
- * Return Value: 0 if in range, non-zero otherwise.
+ * Purpose: Finds the arena a pointer is in, if it is in our heap or any of
+ * our mappings.
+ * Return Value: Pointer to the arena, NULL if the pointer is not in range.
  */
-static int not_in_range(void *ptr)
+static struct arena *find_arena(void *ptr)
 {
 	char *ptr_to_free = ptr;
-	const char *const heap_boundary = heap + HEAP_SIZE;
+	struct arena *arena;
 
-	return (ptr_to_free < heap) || (ptr_to_free >= heap_boundary);
+	if (ptr_to_free >= heap && ptr_to_free < heap + sizeof(heap))
+		return &main_arena;
+	arena = lookup_arena(ptr);
+	if (!arena || ptr_to_free >= (char *) arena + arena->map_size)
+		return NULL;
+	return arena;
 }
 
 /*
  * Purpose: Takes in a pointer and tests to see if it is a pointer to an allocated
- * block of memory.
+ * block of memory, which only takes looking up one bit of the arena's
+ * block_starts. The pointer has to already be in range of the arena.
  * Return Value: 0 if it is a valid mymalloc'd pointer, non-zero otherwise.
  */
-static int non_mymalloc_ptr(void *ptr)
+static int non_mymalloc_ptr(struct arena *arena, void *ptr)
 {
-	struct header_data *meta;
-	const char *const heap_boundary = heap + HEAP_SIZE;
-	char *heap_byte = heap;
-	char *block_ptr;
-
-	do {
-		block_ptr = heap_byte + sizeof(*meta);
-		if (ptr == block_ptr)
-			return 0;
-		meta = (struct header_data *) heap_byte;
-		heap_byte += sizeof(*meta) + meta->block_size;
-	} while (heap_byte < heap_boundary);
-	return 1;
-}
-
-/*
- * Purpose: Goes through the heap and combines free blocks into one block. Gets
- * called after every call to myfree().
- * Return Value: None.
- */
-static void coalesce_blocks(void)
-{
-	struct header_data *first_meta, *next_meta;
-	unsigned int free_block_size;
-	const char *const heap_boundary = heap + HEAP_SIZE;
-	char *heap_byte = heap;
-
-	do {
-		first_meta = (struct header_data *) heap_byte;
-		heap_byte += first_meta->block_size + sizeof(*first_meta);
-		if (first_meta->free) {
-			while ((heap_byte + sizeof(*first_meta)) <= heap_boundary) {
-				next_meta = (struct header_data *) heap_byte;
-				if (!next_meta->free)
-					break;
-				free_block_size = next_meta->block_size + sizeof(*next_meta);
-				first_meta->block_size += free_block_size;
-				heap_byte += free_block_size;
-			}
-		}
-	} while ((heap_byte + sizeof(*first_meta)) <= heap_boundary);
+	char *block_ptr = ptr;
+	size_t unit;
+
+	if (block_ptr < arena->start + sizeof(struct header_data))
+		return 1;
+	if (!arena->block_starts)
+		return block_ptr != arena->start + sizeof(struct header_data);
+	unit = block_ptr - sizeof(struct header_data) - arena->start;
+	if (unit % ALIGNMENT)
+		return 1;
+	unit /= ALIGNMENT;
+	return !(__atomic_load_n(&arena->block_starts[unit / 8], __ATOMIC_RELAXED) & (1 << unit % 8));
+}
+
+/*
+ * Purpose: Looks a pointer that is in none of our mappings up among the big
+ * blocks unmapped most recently. heap_lock must not be held.
+ * Return Value: 1 if it was one of them, 0 otherwise.
+ */
+static int freed_big_block(void *ptr)
+{
+	int i, found = 0;
+
+	pthread_mutex_lock(&heap_lock);
+	for (i = 0; i < FREED_BIG_BLOCKS && !found; i++)
+		found = freed_big_blocks[i] == ptr;
+	pthread_mutex_unlock(&heap_lock);
+	return found;
+}
+
+/*
+ * Purpose: Checks the main 3 error cases for a pointer given back to us:
+ * NULL, not in range, and non malloc'd. A pointer that is not in range but
+ * was one of the big blocks freed last is being freed again instead.
+ * resizing is set when the pointer was given to myrealloc, so the warning
+ * says realloc instead of free.
+ * Return Value: NULL with *arena set to the pointer's arena if it is a
+ * valid mymalloc'd pointer, the warning to give otherwise.
+ */
+static const char *check_ptr(void *ptr, struct arena **arena, int resizing)
+{
+	if (!ptr)
+		return "Attempting to free NULL pointer.";
+	if (!(*arena = find_arena(ptr))) {
+		if (freed_big_block(ptr))
+			return resizing ? "Attempting to realloc freed pointer." :
+					  "Attempting to redudantly free pointer.";
+		return resizing ? "Attempting to realloc pointer not in range." :
+				  "Attempting to free pointer not in range.";
+	}
+	if (non_mymalloc_ptr(*arena, ptr))
+		return resizing ? "Attempting to realloc nonmalloc'd pointer." :
+				  "Attempting to free nonmalloc'd pointer.";
+	return NULL;
 }
 
 /*
  * Purpose: Frees an allocated section of memory from our heap to be used
- * later.
+ * later. Pointers are checked without locking the heap, since a valid
+ * block's header and bit in block_starts only change once it is free.
+ * Small blocks go into the freeing thread's cache, whichever thread they
+ * came from, and anything else goes back to the heap with heap_lock held.
  * Return Value: None.
  */
 void myfree(void *ptr, const char *filename, int line_number)
 {
-	struct header_data *meta;
-	const char *err = NULL;
+	struct tcache_entry *entry = ptr;
+	struct header_data *meta, header;
+	struct arena *arena;
+	const char *err;
+	int class;
 
-	/* Check main 3 error cases: NULL, not in range, and non malloc'd */
-	if (!ptr)
-		err = "Attempting to free NULL pointer.";
-	else if (not_in_range(ptr))
-		err = "Attempting to free pointer not in range.";
-	else if (non_mymalloc_ptr(ptr))
-		err = "Attempting to free nonmalloc'd pointer.";
-	if (err) {
+	pthread_once(&heap_once, initialize_heap);
+
+	if ((err = check_ptr(ptr, &arena, 0))) {
 		WARN(err);
 		return;
 	}
@@ -177,11 +969,138 @@ void myfree(void *ptr, const char *filename, int line_number)
 	/* Get the meta data of the valid block the user passed in */
 	meta = (struct header_data *) ((char *) ptr - sizeof(*meta));
 
-	if (!meta->free) {
-		meta->free = 1;
-		/* Go through the heap and combine free'd blocks */
-		coalesce_blocks();
+	load_header(meta, &header);
+
+	if (arena->block_starts && block_size(&header) + sizeof(header) <= SMALL_CLASS_MAX) {
+		if (header.free || entry->key == TCACHE_KEY) {
+			WARN("Attempting to redudantly free pointer.");
+			return;
+		}
+		class = size_class(block_size(&header));
+		register_tcache();
+		if (tcache.counts[class] >= TCACHE_COUNT) {
+			pthread_mutex_lock(&heap_lock);
+			drain_tcache(class, TCACHE_COUNT - TCACHE_FILL);
+			pthread_mutex_unlock(&heap_lock);
+		}
+		entry->next = tcache.entries[class];
+		entry->key = TCACHE_KEY;
+		tcache.entries[class] = entry;
+		tcache.counts[class]++;
+		return;
+	}
+
+	pthread_mutex_lock(&heap_lock);
+	if (!arena->block_starts) {
+		freed_big_blocks[next_freed_big_block++ % FREED_BIG_BLOCKS] = ptr;
+		unmap_arena(arena);
+	} else if (!meta->free)
+		release_block(arena, meta);
+	else
+		err = "Attempting to redudantly free pointer.";
+	pthread_mutex_unlock(&heap_lock);
+	if (err)
+		WARN(err);
+}
+
+/*
+ * Purpose: Resizes an allocated block to size bytes, keeping what is in it.
+ * A block in an arena is shrunk by splitting off its end and grown by taking
+ * in the free block right after it when that makes it big enough, so it
+ * only gets moved to a new block when it has to. ptr is checked the same
+ * way myfree checks it, a NULL ptr just allocates and a size of 0 frees.
+ * Return Value: Pointer to the resized block, NULL if it could not be
+ * resized, in which case ptr is left as it was.
+ */
+void *myrealloc(void *ptr, size_t size, const char *filename, int line_number)
+{
+	struct tcache_entry *entry = ptr;
+	struct header_data *meta, *next_meta, header;
+	struct arena *arena;
+	size_t old_size, rounded;
+	const char *err;
+	void *new_ptr;
+
+	if (!ptr)
+		return mymalloc(size, filename, line_number);
+
+	pthread_once(&heap_once, initialize_heap);
+
+	if ((err = check_ptr(ptr, &arena, 1))) {
+		WARN(err);
+		return NULL;
+	}
+	if (!size) {
+		myfree(ptr, filename, line_number);
+		return NULL;
+	}
+
+	meta = (struct header_data *) ((char *) ptr - sizeof(*meta));
+
+	if (!arena->block_starts) {
+		/* A big block stays put as long as it fits and is still too big for an arena */
+		old_size = arena->end - (char *) ptr;
+		if (size <= old_size && size > MAX_ARENA_BLOCK)
+			return ptr;
 	} else {
-		WARN("Attempting to redudantly free pointer.");
+		load_header(meta, &header);
+		if (header.free || entry->key == TCACHE_KEY) {
+			WARN("Attempting to realloc freed pointer.");
+			return NULL;
+		}
+		old_size = block_size(&header);
+		if (size <= MAX_ARENA_BLOCK) {
+			rounded = size < MIN_BLOCK_SIZE ? MIN_BLOCK_SIZE : BLOCK_ROUND(size);
+			pthread_mutex_lock(&heap_lock);
+			next_meta = next_block(meta);
+			if (rounded > old_size && next_meta->free &&
+			    old_size + sizeof(*next_meta) + block_size(next_meta) >= rounded) {
+				remove_free_block(next_meta);
+				mark_block(next_meta, 0);
+				set_block_size(meta, old_size + sizeof(*next_meta) + block_size(next_meta));
+				set_prev_free(next_block(meta), 0);
+			}
+			if (rounded <= block_size(meta)) {
+				split_block(meta, rounded);
+				pthread_mutex_unlock(&heap_lock);
+				return ptr;
+			}
+			pthread_mutex_unlock(&heap_lock);
+		}
+	}
+
+	/* Move it to a new block */
+	if (!(new_ptr = mymalloc(size, filename, line_number)))
+		return NULL;
+	memcpy(new_ptr, ptr, old_size < size ? old_size : size);
+	myfree(ptr, filename, line_number);
+	return new_ptr;
+}
+
+/*
+ * Purpose: Returns a pointer to nmemb * size bytes of zeroed memory. Blocks
+ * too big for an arena always come from a fresh mapping, which the OS has
+ * already zeroed, so only blocks from the heap and arenas get cleared.
+ * Return Value: Pointer to the first byte of allocated memory.
+ */
+void *mycalloc(size_t nmemb, size_t size, const char *filename, int line_number)
+{
+	void *ptr;
+
+	if (size && nmemb > SIZE_MAX / size) {
+		WARN("Heap out of memory.");
+		return NULL;
 	}
+	size *= nmemb;
+
+	/*
+	 * Bigger blocks are only already zeroed because myfree unmaps them
+	 * right away, so caching big mappings would mean clearing them here.
+	 * Blocks from a newly mapped arena are cleared even though they are
+	 * zero too, since tracking which parts of an arena were never handed
+	 * out would cost more than the memset.
+	 */
+	if ((ptr = mymalloc(size, filename, line_number)) && size <= MAX_ARENA_BLOCK)
+		memset(ptr, 0, size);
+	return ptr;
 }
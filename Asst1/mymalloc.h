@@ -5,8 +5,14 @@
 
 #define malloc(x) mymalloc(x, __FILE__, __LINE__)
 #define free(x) myfree(x, __FILE__, __LINE__)
+#define aligned_alloc(x, y) myaligned_alloc(x, y, __FILE__, __LINE__)
+#define realloc(x, y) myrealloc(x, y, __FILE__, __LINE__)
+#define calloc(x, y) mycalloc(x, y, __FILE__, __LINE__)
 
 void *mymalloc(size_t size, const char *filename, const int line_number);
 void myfree(void *ptr, const char *filename, const int line_number);
+void *myaligned_alloc(size_t alignment, size_t size, const char *filename, const int line_number);
+void *myrealloc(void *ptr, size_t size, const char *filename, const int line_number);
+void *mycalloc(size_t nmemb, size_t size, const char *filename, const int line_number);
 
 #endif /* _MY_MALLOC_H */